@@ -1,51 +1,94 @@
-#include <iostream>
+#include <cstdio>
+#include <algorithm>
 #include <iomanip>
 #include <fstream>
 
 #include "AHRS.h"
-
-// Initialize static variables
-double AHRS::t = 0.0;
+#include "Log.h"
+#include "Profile.h"
 
 // AHRS constructor
-AHRS::AHRS(QString _port, int id_in):
+AHRS::AHRS(QString _port, int id_in, const bool raw, const imuMode &m):
     port(_port),
     id(id_in),
-    qout(10),
-    data(NFLOATS + 1),
+    mode(m),
+    data(MAXFLOATS + 1),
     qs(nullptr),
+    rs(nullptr),
+    sample(),
+    event(nullptr),
     running(false),
-    XOR(0)
+    negotiated(false),
+    opened(false),
+    waking(false),
+    skipped(0),
+    backlog(0)
 {
-    qs.reset(new QSerialPort(this));
+    msg << "Connecting AHRS " << id << " at port " << port.toStdString();
+    msg << (raw ? " (raw)" : "") << std::endl;
+    printMsg();
 
-    qs->setPortName(port);
-    qs->setBaudRate(QSerialPort::Baud57600);
+    if (raw)
+    {
+        std::string path = port.toStdString();
+        if (path[0] != '/')
+            path = "/dev/" + path;
 
-    msg << "Connecting AHRS " << id << " at port " << port.toStdString() << std::endl;
-    printMsg();
+        rs.reset(new rawSerial());
+        opened = rs->open(path, IMUBAUD, parser.frameSize());
+    }
+    else
+    {
+        qs.reset(new QSerialPort(this));
 
-    if (qs->open(QSerialPort::ReadWrite))
+        qs->setPortName(port);
+        qs->setBaudRate(IMUBAUD);
+
+        opened = qs->open(QSerialPort::ReadWrite);
+    }
+
+    if (opened)
     {
-        if (qs->bytesAvailable() < 100)
+        // Start the output now, settle() waits for it so that several AHRS wake up together
+        if (available() < 100)
         {
-            qs->write(QByteArray("#o1", 3));
-            qs->waitForBytesWritten(-1);
-            qs->waitForReadyRead(1500);
+            writeCmd("#o1", 3);
+            waking = true;
         }
-
-        clearBuffer();
-
-        msg << "AHRS " << id << " ready" << std::endl;
-        printMsg();
     }
     else
     {
         id = port.toInt();
 
-        msg << "Error opening port " << port.toStdString() << std::endl;
-        printMsg();
+        Log::print(LOG_ERROR, "Error opening port %s", port.toStdString().c_str());
+    }
+}
+
+// Wait for the output started by the constructor, then stop it and clear the buffer
+//   deadline: latest wake-up time (monotonic ns), shared by the AHRS brought up together
+bool AHRS::settle(const qint64 deadline)
+{
+    if (!opened)
+        return false;
+
+    bool awake = true;
+
+    if (waking)
+    {
+        qint64 left = std::max<qint64>(0, deadline - Clock::now());
+        awake = available() > 0 || waitForData(static_cast<int>(left/1000000));
+        waking = false;
     }
+
+    clearBuffer();
+
+    if (awake)
+        msg << "AHRS " << id << " ready" << std::endl;
+    else
+        msg << "AHRS " << id << " not responding" << std::endl;
+    printMsg();
+
+    return awake;
 }
 
 // AHRS destructor
@@ -55,42 +98,109 @@ AHRS::~ AHRS()
     printMsg();
 }
 
-// Output the contents of buffer "msg" and clear
+// Pass the contents of buffer "msg" to the logger and clear
 void AHRS::printMsg()
 {
-    std::cout << msg.rdbuf() << std::flush;
-    msg.clear();
+    Log::text(LOG_INFO, msg.str());
+    msg.str("");
 }
 
-// Stop data output and clear the buffer
-void AHRS::clearBuffer()
+// Number of bytes waiting at the port
+qint64 AHRS::available()
 {
-    qs->write(QByteArray("#o0", 3));
-    qs->waitForBytesWritten(-1);
+    return rs ? rs->bytesAvailable() : qs->bytesAvailable();
+}
+
+// Read up to len bytes from the port
+qint64 AHRS::readBytes(char *buf, const qint64 len)
+{
+    return rs ? rs->read(buf, len) : qs->read(buf, len);
+}
 
-    while (qs->bytesAvailable() > 0)
+// Send a command and wait until it is written
+void AHRS::writeCmd(const char *cmd, const qint64 len)
+{
+    if (rs)
+        rs->write(cmd, len);
+    else
     {
-        qs->read(u.buffer, BUFSIZE);
-        qs->waitForReadyRead(5);
+        qs->write(cmd, len);
+        qs->waitForBytesWritten(-1);
     }
 }
 
-// Shift the input buffer and read a new byte
-void AHRS::circshift(size_t size)
+// Wait up to ms milliseconds for new data
+bool AHRS::waitForData(const int ms)
 {
-    if (!qs->bytesAvailable())
-        qs->waitForReadyRead(-1);
+    return rs ? rs->waitForReadyRead(ms) : qs->waitForReadyRead(ms);
+}
+
+// Set local line speed (and frame wake-up threshold for the raw backend)
+void AHRS::setLine(const int baud)
+{
+    if (rs)
+        rs->configure(baud, parser.frameSize());
+    else
+        qs->setBaudRate(baud);
+}
+
+// Send the streaming mode to the AHRS and follow it locally
+void AHRS::setMode(const imuMode &m)
+{
+    char cmd[40];
+    int n = snprintf(cmd, sizeof cmd, "#om%03x#os%d", m.mask, m.seq ? 1 : 0);
+
+    if (m.interval > 0)
+        n += snprintf(cmd + n, sizeof cmd - n, "#oi%d", m.interval);
 
-    for (unsigned i = 0; i < size - 1; i++)
-        u.buffer[i] = u.buffer[i + 1];
+    writeCmd(cmd, n);
+    parser.setLayout(m.mask, m.seq);
 
-    qs->read(&u.buffer[size - 1], 1);
+    // Line speed changes last, the firmware switches after the command
+    n = snprintf(cmd, sizeof cmd, "#b%d", m.baud);
+    writeCmd(cmd, n);
+    setLine(m.baud);
 }
 
-// Update current time from main thread
-void AHRS::timeUpdate(const double t_main)
+// Wait up to ms milliseconds for a valid frame in the current layout
+bool AHRS::probe(const int ms)
 {
-    t = t_main;
+    qint64 end = Clock::now() + static_cast<qint64>(ms)*1000000;
+    size_t len;
+
+    while (Clock::now() < end)
+    {
+        waitForData(10);
+
+        char *ptr = parser.writePtr(len);
+        qint64 n = readBytes(ptr, len);
+
+        if (n > 0)
+        {
+            parser.commit(n);
+
+            if (parser.next(sample.q))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Stop data output and clear the buffer
+void AHRS::clearBuffer()
+{
+    char scratch[MAXBUF];
+
+    writeCmd("#o0", 3);
+
+    while (available() > 0)
+    {
+        readBytes(scratch, MAXBUF);
+        waitForData(5);
+    }
+
+    parser.clear();
 }
 
 // Reset the AHRS, clear buffer and restart output
@@ -101,10 +211,48 @@ void AHRS::sync()
 
     clearBuffer();
 
-    connect(qs.get(), &QSerialPort::readyRead, this, &AHRS::read);
+    skipped = 0;
+    backlog = 0;
+
+    // Negotiate a reduced frame layout and line speed, fall back to full frames
+    if (mode.mask != ALLCH || mode.seq || mode.interval > 0 || mode.baud != IMUBAUD)
+    {
+        setMode(mode);
+        writeCmd("#oab#o1", 7);
+
+        negotiated = true;
+
+        if (probe(500))
+        {
+            msg << "AHRS " << id << " streaming " << parser.floats() << " channels";
+            msg << (mode.seq ? " with sequence counter" : "") << " at " << mode.baud << " bps" << std::endl;
+            printMsg();
+        }
+        else
+        {
+            Log::print(LOG_WARN, "AHRS %d did not accept streaming mode, using full frames", id);
 
-    qs->write(QByteArray("#oab#o1", 7));
-    qs->waitForBytesWritten(-1);
+            // The AHRS may or may not have switched its line speed, restore
+            // full frames at the new speed and again at the power-up speed
+            const imuMode full{IMUBAUD, ALLCH, false, 0};
+
+            writeCmd("#o0", 3);
+            setMode(full);
+
+            writeCmd("#o0", 3);
+            setMode(full);
+
+            negotiated = false;
+        }
+
+        clearBuffer();
+    }
+
+    // The raw backend is read by serialPoller instead
+    if (qs)
+        connect(qs.get(), &QSerialPort::readyRead, this, &AHRS::read);
+
+    writeCmd("#oab#o1", 7);
 
     running = true;
 
@@ -114,33 +262,61 @@ void AHRS::sync()
     emit ready();
 }
 
-// Read a data block from the AHRS
+// Port readyRead handler
 void AHRS::read()
 {
-    if (qs->bytesAvailable() >= BUFSIZE)
+    decode(Clock::now());
+}
+
+// Read all available bytes from the AHRS and decode complete frames
+// Every frame is logged, but only the newest one is published to the control loop
+//   stamp: arrival time of the data (monotonic ns)
+void AHRS::decode(const qint64 stamp)
+{
+    size_t len;
+    unsigned int nf = 0;
+
+    while (available() > 0)
     {
-        XOR = 0;
+        char *ptr = parser.writePtr(len);
+        qint64 n = readBytes(ptr, len);
 
-        qs->read(u.buffer, BUFSIZE);
+        if (n <= 0)
+            break;
 
-        for (int i = 1; i < BUFSIZE - 1; i++)
-            XOR ^= u.buffer[i];
+        parser.commit(n);
 
-        while (u.header != 255 || u.checksum != XOR)
+        while (parser.next(sample.q))
         {
-            XOR ^= u.checksum;
-            circshift(BUFSIZE);
-            XOR ^= ~u.header;
-        }
+            data[0].push_back(0);
+            for (unsigned i = 1; i < data.size(); i++)
+                data[i].push_back(sample.q[i - 1]);
 
-        data[0].push_back(t);
-        for (unsigned i = 1; i < data.size(); i++)
-        {
-            data[i].push_back(u.q[i - 1]);
-            qout[i - 1] = u.q[i - 1];
+            nf++;
         }
+    }
+
+    if (nf > 0)
+    {
+        // Frames drained at once left the AHRS one output interval apart, the
+        // newest one (the published sample) at the time of the read
+        const qint64 per = (negotiated && mode.interval > 0 ? mode.interval : IMUPER)*1000000LL;
+        const size_t first = data[0].size() - nf;
+
+        for (unsigned int k = 0; k < nf; k++)
+            data[0][first + k] = Clock::seconds(stamp - (nf - 1 - k)*per);
+
+        skipped += nf - 1;
+        if (nf > backlog)
+            backlog = nf;
+
+        sample.stamp = stamp;
+        slot.write(sample);
 
-        emit sendData(id, qout);
+        if (event)
+            event->notify();
+
+        Profile::record(ST_DECODE, Clock::now() - stamp);
     }
 }
 
@@ -178,8 +354,24 @@ void AHRS::stop()
         msg << "Stopping AHRS " << id << std::endl;
         printMsg();
 
-        disconnect(qs.get(), &QSerialPort::readyRead, 0, 0);
+        if (qs)
+            disconnect(qs.get(), &QSerialPort::readyRead, 0, 0);
 
         clearBuffer();
+
+        // Restore power-up settings so that the next session starts from a known state
+        if (negotiated)
+        {
+            setMode(imuMode{IMUBAUD, ALLCH, false, 0});
+            negotiated = false;
+        }
+
+        msg << "AHRS " << id << ": " << parser.getFrames() << " frames, "
+            << parser.getBadFrames() << " bad frames, "
+            << parser.getResyncBytes() << " resync bytes, "
+            << parser.getLostFrames() << " lost frames" << std::endl;
+        msg << "AHRS " << id << ": " << skipped << " frames skipped, "
+            << "maximum backlog " << backlog << " frames" << std::endl;
+        printMsg();
     }
 }
@@ -7,8 +7,30 @@
 #include <QSerialPort>
 #include <QVector>
 
-#define NFLOATS 10
-#define BUFSIZE (4*NFLOATS+2)
+#include "Parser.h"
+#include "Serial.h"
+#include "Channel.h"
+#include "Clock.h"
+
+#define IMUBAUD 57600   // Power-up line speed of the Razor firmware
+#define IMUWAKE 1500    // Time allowed for the AHRS to start streaming (ms)
+#define IMUPER 20       // Output interval of the Razor firmware by default (ms)
+
+// AHRS streaming mode
+struct imuMode
+{
+    int baud;           // Line speed while streaming (bps)
+    unsigned int mask;  // Channels streamed (bit i: float i)
+    bool seq;           // Frames carry a sequence counter
+    int interval;       // Output interval (ms, 0: firmware default)
+};
+
+// AHRS sample passed to the control loop
+struct imuSample
+{
+    qint64 stamp;       // Arrival time (monotonic ns)
+    float q[MAXFLOATS]; // Frame contents, indexed by channel
+};
 
 // Sparkfun Razor 9-DOF IMU class
 class AHRS : public QObject
@@ -18,43 +40,51 @@ class AHRS : public QObject
 private:
     QString port;
     int id;
+    imuMode mode;
 
-    static double t;
-
-    QVector<float> qout;
     std::vector<std::vector<float> > data;
     std::unique_ptr<QSerialPort> qs;
+    std::unique_ptr<rawSerial> rs;
     std::stringstream msg;
+    razorParser parser;
+    imuSample sample;
+    latestSlot<imuSample> slot;
+    frameEvent *event;      // Signalled when a sample is published (optional)
     bool running;
-    char XOR;
-
-#pragma pack(push, 1)
-    union
-    {
-        char buffer[BUFSIZE];
-        struct
-        {
-            uchar header;
-            float q[NFLOATS];
-            char checksum;
-        };
-    } u;
-#pragma pack(pop)
+    bool negotiated;        // Streaming mode differs from power-up settings
+    bool opened;            // Port opened by the constructor
+    bool waking;            // Output started, not yet seen by settle()
+
+    unsigned long skipped;  // Frames logged but superseded before being sent
+    unsigned int backlog;   // Largest number of frames decoded in one read
 
     void printMsg();
     void clearBuffer();
-    void circshift(size_t size);
+
+    qint64 available();
+    qint64 readBytes(char *buf, const qint64 len);
+    void writeCmd(const char *cmd, const qint64 len);
+    bool waitForData(const int ms);
+    void setLine(const int baud);
+    void setMode(const imuMode &m);
+    bool probe(const int ms);
 
 public:
-    AHRS(QString _port, int id_in);
+    AHRS(QString _port, int id_in, const bool raw = false,
+         const imuMode &m = imuMode{IMUBAUD, ALLCH, false, 0});
     ~AHRS();
 
+    bool settle(const qint64 deadline);
+
+    int handle() const { return rs ? rs->handle() : -1; }
+    const latestSlot<imuSample> &latest() const { return slot; }
+    void notify(frameEvent *ev) { event = ev; }
+    void decode(const qint64 stamp);
+
 signals:
     void ready();
-    void sendData(const int id, const QVector<float> qout);
 
 public slots:
-    static void timeUpdate(const double t_main);
     void sync();
     void read();
     void dump(const std::string pathDate);
@@ -0,0 +1,150 @@
+#include <cstring>
+#include <algorithm>
+
+#include "Bus.h"
+#include "Clock.h"
+#include "Log.h"
+#include "Profile.h"
+#include "MotorConfig.h"
+
+static const char *busName[BUS_NPRIO] = {"command", "upload", "telemetry"};
+
+// eposBus constructor, opens the gateway and starts the scheduler thread
+eposBus::eposBus() : running(true), nseq(0)
+{
+    DWORD errid = 0;
+    char dev[] = "EPOS2";
+#if RS232 == 1
+    char ptc[] = "MAXON_RS232";
+    char ifc[] = "RS232";
+    char prt[] = RS232PORT;
+#else
+    char ptc[] = "MAXON SERIAL V2";
+    char ifc[] = "USB";
+    char prt[] = "USB0";
+#endif
+    keyHandle = VCS_OpenDevice(dev, ptc, ifc, prt, &errid);
+
+    if (!keyHandle)
+    {
+        char errBuff[100];
+        if (VCS_GetErrorInfo(errid, errBuff, 100))
+            Log::print(LOG_ERROR, "EPOS2 error %u (%s)", errid, errBuff);
+
+        throw "EPOS2";
+    }
+
+    memset(stats, 0, sizeof stats);
+
+    worker = std::thread(&eposBus::loop, this);
+}
+
+// eposBus destructor, serves the pending requests and closes the gateway
+eposBus::~eposBus()
+{
+    {
+        std::lock_guard<piMutex> lk(lock);
+        running = false;
+    }
+    wake.notify_one();
+    worker.join();
+
+    DWORD errid;
+    VCS_CloseDevice(keyHandle, &errid);
+
+    Log::print(LOG_INFO, "EPOS2 cleared");
+}
+
+// Queue a request, the future becomes ready (or holds the exception) when done
+//   due: do not start before this time (monotonic ns)
+std::future<void> eposBus::post(const busPrio prio, std::function<void()> job, const qint64 due)
+{
+    auto task = std::make_shared<std::packaged_task<void()>>(job);
+    std::future<void> done = task->get_future();
+
+    {
+        std::lock_guard<piMutex> lk(lock);
+        qint64 now = Clock::now();
+        request r{prio, nseq++, std::max(now, due), [task]() { (*task)(); }};
+
+        if (due > now)
+            delayed.insert(std::make_pair(due, r));
+        else
+            queue.push(r);
+    }
+    wake.notify_one();
+
+    return done;
+}
+
+// Print and clear the latency statistics
+void eposBus::report()
+{
+    std::lock_guard<piMutex> lk(lock);
+
+    for (int p = 0; p < BUS_NPRIO; p++)
+    {
+        latency &s = stats[p];
+
+        if (s.n > 0)
+        {
+            Log::print(LOG_INFO, "Bus %s: %lu requests, wait mean %lld us, max %lld us, bus mean %lld us, max %lld us",
+                       busName[p], s.n, s.waitSum / static_cast<qint64>(s.n) / 1000, s.waitMax / 1000,
+                       s.busySum / static_cast<qint64>(s.n) / 1000, s.busyMax / 1000);
+        }
+    }
+
+    memset(stats, 0, sizeof stats);
+}
+
+// Scheduler loop, always serves the highest priority request first
+void eposBus::loop()
+{
+    std::unique_lock<piMutex> lk(lock);
+
+    while (true)
+    {
+        // Move due requests to the queue
+        qint64 now = Clock::now();
+        while (!delayed.empty() && delayed.begin()->first <= now)
+        {
+            queue.push(delayed.begin()->second);
+            delayed.erase(delayed.begin());
+        }
+
+        if (queue.empty())
+        {
+            if (!running)
+                break;
+
+            if (delayed.empty())
+                wake.wait(lk);
+            else
+                wake.wait_for(lk, std::chrono::nanoseconds(delayed.begin()->first - now));
+
+            continue;
+        }
+
+        request r = queue.top();
+        queue.pop();
+        lk.unlock();
+
+        qint64 t0 = Clock::now();
+        r.job();
+        qint64 t1 = Clock::now();
+
+        Profile::record(static_cast<stage>(ST_WAITCMD + r.prio), t0 - r.stamp);
+        Profile::record(ST_VCS, t1 - t0);
+
+        lk.lock();
+
+        latency &s = stats[r.prio];
+        s.n++;
+        s.waitSum += t0 - r.stamp;
+        s.busySum += t1 - t0;
+        if (t0 - r.stamp > s.waitMax)
+            s.waitMax = t0 - r.stamp;
+        if (t1 - t0 > s.busyMax)
+            s.busyMax = t1 - t0;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include <map>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+#include <QtGlobal>
+
+#include "Channel.h"
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef void* HANDLE;
+typedef int BOOL;
+
+#include "Definitions.h"
+
+// Request classes, highest priority first
+enum busPrio {BUS_COMMAND, BUS_UPLOAD, BUS_TELEMETRY, BUS_NPRIO};
+
+// Scheduler owning the EPOS2 gateway
+// A single thread serves all motors from a priority queue, so a queued
+// telemetry read never delays a command. Requests already on the bus are
+// not preempted. Delayed requests enter the queue when due, those still
+// waiting at shutdown are dropped.
+class eposBus
+{
+private:
+    struct request
+    {
+        busPrio prio;
+        unsigned long seq;          // Keeps FIFO order within a class
+        qint64 stamp;               // Queueing (or due) time (ns)
+        std::function<void()> job;
+
+        bool operator<(const request &r) const
+        {
+            return prio != r.prio ? prio > r.prio : seq > r.seq;
+        }
+    };
+
+    // Latency statistics per class (ns)
+    struct latency
+    {
+        unsigned long n;
+        qint64 waitSum, waitMax;    // Time spent in the queue
+        qint64 busySum, busyMax;    // Time spent on the bus
+    };
+
+    HANDLE keyHandle;
+
+    std::priority_queue<request> queue;
+    std::multimap<qint64, request> delayed;
+    piMutex lock;                   // Also taken by the real-time thread when it posts
+    std::condition_variable_any wake;
+    std::thread worker;
+    bool running;
+    unsigned long nseq;
+
+    latency stats[BUS_NPRIO];
+
+    void loop();
+
+public:
+    eposBus();
+    ~eposBus();
+
+    HANDLE handle() const { return keyHandle; }
+
+    std::future<void> post(const busPrio prio, std::function<void()> job, const qint64 due = 0);
+    void report();
+};
+
+#endif // BUS_H
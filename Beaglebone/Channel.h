@@ -0,0 +1,139 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <atomic>
+#include <mutex>
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+
+#include "Clock.h"
+
+// Single-producer "latest value" slot protected by a sequence lock
+// The writer never waits; readers retry if they overlap a write. T must be
+// trivially copyable.
+template <typename T>
+class latestSlot
+{
+private:
+    std::atomic<unsigned int> seq; // Odd while a write is in progress
+    T value;
+
+public:
+    latestSlot() : seq(0), value() {}
+
+    // Publish a new value (producer thread only)
+    void write(const T &v)
+    {
+        unsigned int s = seq.load(std::memory_order_relaxed);
+
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        value = v;
+
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Current sequence, differs from "last" of read() when a new value is there
+    unsigned int sequence() const { return seq.load(std::memory_order_acquire); }
+
+    // Copy the latest value if it changed since sequence "last"
+    // Returns true and updates "last" when a new value was read
+    bool read(T &v, unsigned int &last) const
+    {
+        unsigned int s0, s1 = 0;
+
+        do
+        {
+            s0 = seq.load(std::memory_order_acquire);
+
+            if (s0 == last)
+                return false;
+
+            if (s0 & 1)
+                continue;
+
+            v = value;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s1 = seq.load(std::memory_order_relaxed);
+        }
+        while (s0 & 1 || s0 != s1);
+
+        last = s0;
+
+        return true;
+    }
+};
+
+// Event counter signalled by producers and waited on by one consumer
+class frameEvent
+{
+private:
+    std::mutex lock;
+    std::condition_variable cv;
+    unsigned long count;
+
+public:
+    frameEvent() : count(0) {}
+
+    // Signal a new value (any thread)
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            count++;
+        }
+        cv.notify_one();
+    }
+
+    // Wait until the count differs from "seen" or until the deadline
+    // (monotonic ns), false on timeout; updates "seen"
+    bool wait(unsigned long &seen, const qint64 deadline)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+
+        while (count == seen)
+        {
+            qint64 left = deadline - Clock::now();
+            if (left <= 0)
+                return false;
+
+            cv.wait_for(lk, std::chrono::nanoseconds(left));
+        }
+
+        seen = count;
+        return true;
+    }
+};
+
+// Mutex with priority inheritance, for state shared by the real-time thread
+// and normal threads: a holder that blocks a SCHED_FIFO waiter runs at the
+// waiter's priority until it unlocks. Usable with std::lock_guard.
+class piMutex
+{
+private:
+    pthread_mutex_t mtx;
+
+public:
+    piMutex()
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+        pthread_mutex_init(&mtx, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    ~piMutex() { pthread_mutex_destroy(&mtx); }
+
+    piMutex(const piMutex &) = delete;
+    piMutex &operator=(const piMutex &) = delete;
+
+    void lock() { pthread_mutex_lock(&mtx); }
+    void unlock() { pthread_mutex_unlock(&mtx); }
+    bool try_lock() { return pthread_mutex_trylock(&mtx) == 0; }
+};
+
+#endif // CHANNEL_H
@@ -0,0 +1,146 @@
+#include <time.h>
+#include <algorithm>
+#include <thread>
+
+#include <QThread>
+
+#include "ChannelBench.h"
+#include "Log.h"
+
+// Process CPU time (ns), both threads included
+static qint64 cpuTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+    return static_cast<qint64>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+// channelBench constructor
+channelBench::channelBench() : received(0) {}
+
+// Send n samples at BENCHRATE through each path and log the latency
+// percentiles and the CPU time per sample
+void channelBench::run(const int n)
+{
+    qRegisterMetaType<QVector<float>>("QVector<float>");
+    qRegisterMetaType<qint64>("qint64");
+
+    channelBench bench;
+
+    bench.measureSlot(n);
+    bench.measureSignal(n);
+}
+
+// Producer writes the slot and notifies, consumer wakes and reads the newest sample
+void channelBench::measureSlot(const int n)
+{
+    latestSlot<imuSample> slot;
+    frameEvent event;
+
+    lat.assign(n, 0);
+    received = 0;
+
+    qint64 cpu = cpuTime();
+
+    std::thread consumer([this, n, &slot, &event]()
+    {
+        unsigned long seen = 0;
+        unsigned int last = 0;
+        imuSample s;
+
+        while (received < n && event.wait(seen, Clock::now() + 1000000000LL))
+        {
+            if (slot.read(s, last))
+                lat[received++] = Clock::now() - s.stamp;
+        }
+    });
+
+    qint64 next = Clock::now();
+
+    for (int i = 0; i < n; i++)
+    {
+        next += 1000000000/BENCHRATE;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(next - Clock::now()));
+
+        imuSample s;
+        std::fill(s.q, s.q + MAXFLOATS, static_cast<float>(i));
+        s.stamp = Clock::now();
+
+        slot.write(s);
+        event.notify();
+    }
+
+    consumer.join();
+
+    report("latestSlot", n, cpuTime() - cpu);
+}
+
+// Producer emits a queued signal with a fresh vector, as AHRS::sendData did,
+// to a receiver living in the consumer thread
+void channelBench::measureSignal(const int n)
+{
+    QThread consumer;
+    channelBench sink;
+
+    sink.lat.assign(n, 0);
+    sink.moveToThread(&consumer);
+    connect(this, &channelBench::send, &sink, &channelBench::receive, Qt::QueuedConnection);
+
+    qint64 cpu = cpuTime();
+
+    consumer.start();
+
+    qint64 next = Clock::now();
+
+    for (int i = 0; i < n; i++)
+    {
+        next += 1000000000/BENCHRATE;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(next - Clock::now()));
+
+        QVector<float> q(MAXFLOATS, static_cast<float>(i));
+        emit send(Clock::now(), q);
+    }
+
+    // Let the last samples arrive
+    qint64 deadline = Clock::now() + 1000000000LL;
+    while (sink.received < n && Clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    consumer.quit();
+    consumer.wait();
+
+    lat.swap(sink.lat);
+    received = sink.received.load();
+
+    report("queued signal", n, cpuTime() - cpu);
+}
+
+// A sample arrived through the queued signal
+void channelBench::receive(const qint64 stamp, const QVector<float>)
+{
+    if (received < static_cast<int>(lat.size()))
+        lat[received++] = Clock::now() - stamp;
+}
+
+// Log the latency percentiles of the samples received
+//   cpu: process CPU time spent by producer and consumer (ns)
+void channelBench::report(const char *path, const int n, const qint64 cpu)
+{
+    int m = received;
+
+    if (m == 0)
+    {
+        Log::print(LOG_WARN, "Channel bench, %s: no sample received", path);
+        return;
+    }
+
+    std::vector<qint64> l(lat.begin(), lat.begin() + m);
+    std::sort(l.begin(), l.end());
+
+    auto pct = [&l](const double p) { return l[std::min(l.size() - 1, static_cast<size_t>(p*l.size()))]/1000.0; };
+
+    Log::print(LOG_INFO, "Channel bench, %s: %d of %d samples, latency p50 %.1f us, p90 %.1f us, p99 %.1f us, "
+               "max %.1f us, CPU %.1f us per sample", path, m, n, pct(0.5), pct(0.9), pct(0.99), l.back()/1000.0,
+               cpu/1000.0/n);
+}
@@ -0,0 +1,42 @@
+#ifndef CHANNELBENCH_H
+#define CHANNELBENCH_H
+
+#include <atomic>
+#include <vector>
+
+#include <QObject>
+#include <QVector>
+
+#include "AHRS.h"
+
+#define BENCHRATE 1000      // Samples per second sent across threads by the benchmark
+
+// Time an AHRS sample crossing from a producer thread to a consumer thread,
+// either through a latestSlot whose consumer waits on a frameEvent, as the
+// triggered loop does, or through a queued signal carrying a QVector<float>
+// to the event loop of the consumer, as the AHRS used to
+class channelBench : public QObject
+{
+    Q_OBJECT
+
+private:
+    std::vector<qint64> lat;    // Delivery latency of each sample (ns)
+    std::atomic<int> received;
+
+    void measureSlot(const int n);
+    void measureSignal(const int n);
+    void report(const char *path, const int n, const qint64 cpu);
+
+public:
+    channelBench();
+
+    static void run(const int n);
+
+signals:
+    void send(const qint64 stamp, const QVector<float> q);
+
+public slots:
+    void receive(const qint64 stamp, const QVector<float> q);
+};
+
+#endif // CHANNELBENCH_H
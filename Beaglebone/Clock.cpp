@@ -0,0 +1,4 @@
+#include "Clock.h"
+
+// Initialize static variables
+std::atomic<qint64> Clock::epoch(0);
@@ -0,0 +1,36 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <time.h>
+
+#include <QtGlobal>
+
+// Monotonic clock shared by all threads
+// Timestamps are CLOCK_MONOTONIC nanoseconds; session times are measured from
+// the epoch set when a session is started, before the AHRS synchronize
+class Clock
+{
+private:
+    static std::atomic<qint64> epoch;
+
+public:
+    // Current time (ns)
+    static qint64 now()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<qint64>(ts.tv_sec)*1000000000 + ts.tv_nsec;
+    }
+
+    // Start a new session at the current time
+    static void reset() { epoch = now(); }
+
+    // Session epoch (ns)
+    static qint64 start() { return epoch; }
+
+    // Convert a timestamp to session time (s)
+    static double seconds(const qint64 stamp) { return (stamp - epoch)*1e-9; }
+};
+
+#endif // CLOCK_H
@@ -1,54 +1,89 @@
 #include <math.h>
-#include <iostream>
+#include <algorithm>
 
 #include "Control.h"
+#include "Log.h"
 
-// motorControl constructor
-motorControl::motorControl() : mcid(++nc), mode(STANCE) {}
+// motorControl constructor (id is the channel number plus one)
+motorControl::motorControl(const int id) : mcid(id), mode(STANCE), swingStamp(0), trace() {}
 
 // motorControl destructor
-motorControl::~motorControl()
-{
-    nc--;
-}
+motorControl::~motorControl() {}
 
 // Control state machine operator
-void motorControl::operator()(const double ownAnk, const double oppAnk, const double ownAcc)
+//   stamp: time of the control frame (monotonic ns)
+//   ownStamp: arrival time of the own AHRS sample
+void motorControl::operator()(const qint64 stamp, const qint64 ownStamp, const double ownAnk, const double oppAnk,
+                              const double ownAcc)
 {
+    std::lock_guard<piMutex> guard(lock);
+
     // Check if conditions to start swing are met
     if (mode == STANCE)
     {
-        if (i < T.size())
+        // Take over a new trajectory once the previous one has been executed,
+        // replies to earlier uploads are ignored
+        if (stamp >= idleStamp)
         {
-            emit motorAdd(mcid, P[i], V[i], static_cast<BYTE>(T[i]));
-            i++;
+            trajPtr latest = std::atomic_load(&next);
+
+            if (latest != traj)
+            {
+                traj.swap(latest);
+                armed = false;
+                loading = false;
+                gen++;
+            }
         }
 
-        if (ownAnk >= tw && oppAnk <= tp && sFrm > nf && ownAcc < -mt)
+        // Upload the whole trajectory once the previous one has been executed
+        if (!armed && !loading && traj && !traj->T.isEmpty() && stamp >= idleStamp)
         {
-            timer.start();
+            loading = true;
+            emit motorLoad(mcid, traj, gen);
+        }
+
+        // The static period is timed, so that it does not depend on the frame rate
+        bool still = staticStamp > 0 && stamp - staticStamp > nf*NFPER;
+
+        if (armed && ownAnk >= tw && oppAnk <= tp && still && ownAcc < -mt)
+        {
+            swingStamp = stamp;
             mode = SWING;
-            sFrm = 0;
+            staticStamp = 0;
+
+            trace.motor = mcid;
+            trace.imu = ownStamp;
+            trace.detect = stamp;
+
+            // Stride period for the trajectory of the next swings, timed by the AHRS sample
+            if (cadence.heelOff(ownStamp))
+                emit motorCadence(mcid - 1, cadence.stride());
         }
     }
 
-    // Count number of consecutive static frames
-    if (std::abs(ownAcc) <= st)
-        sFrm++;
-    else
-        sFrm = 0;
+    // Start of the static period, from the first static frame
+    if (std::abs(ownAcc) > st)
+        staticStamp = 0;
+    else if (staticStamp == 0)
+        staticStamp = stamp;
 
     // Initiate swing phase
     if (mode == SWING)
     {
-        t = static_cast<double>(timer.elapsed()) / 1000.0;
+        t = (stamp - swingStamp)*1e-9;
 
         if (t >= it)
         {
-            i = 0;
             mode = STANCE;
+            armed = false;
+
+            // The buffer is busy until the trajectory has been run, at least
+            // (the drive reports the end from the actual start)
+            idleStamp = stamp + traj->duration*1000000;
 
-            emit motorRun(mcid);
+            trace.fire = stamp;
+            emit motorRun(mcid, trace);
         }
     }
 }
@@ -57,16 +92,28 @@ void motorControl::operator()(const double ownAnk, const double oppAnk, const do
 void motorControl::setMotor(std::shared_ptr<maxonMotor> motor)
 {
     motor_ = motor;
-    connect(this, &motorControl::motorAdd, motor_.get(), &maxonMotor::addPVT);
-    connect(this, &motorControl::motorRun, motor_.get(), &maxonMotor::runIPM);
+
+    // The motor slots only queue a bus request, run them in the control
+    // thread rather than waiting for the Qt event loop
+    connect(this, &motorControl::motorLoad, motor_.get(), &maxonMotor::addTrajectory, Qt::DirectConnection);
+    connect(this, &motorControl::motorRun, motor_.get(), &maxonMotor::runIPM, Qt::DirectConnection);
+
+    connect(motor_.get(), &maxonMotor::loaded, this, &motorControl::loadedGet);
+    connect(motor_.get(), &maxonMotor::busy, this, &motorControl::busyGet);
 }
 
 // Reset control state machine
 void motorControl::reset()
 {
+    std::lock_guard<piMutex> guard(lock);
+
     mode = STANCE;
-    sFrm = 0;
-    i = 0;
+    staticStamp = 0;
+    cadence.reset();
+    armed = false;
+    loading = false;
+    idleStamp = 0;
+    gen++;
 }
 
 // Get parameters from remote interface
@@ -74,6 +121,8 @@ void motorControl::paramGet(const int ch, const int par, const double val)
 {
     if (ch + 1 == mcid)
     {
+        std::lock_guard<piMutex> guard(lock);
+
         switch (par)
         {
         case 0: kr = val; break;
@@ -87,19 +136,87 @@ void motorControl::paramGet(const int ch, const int par, const double val)
         case 8: tw = val; break;
         case 9: tp = val; break;
         default:
-            std::cout << "Unknown parameter" << std::endl;
+            Log::print(LOG_WARN, "Unknown parameter %d of motor %d", par, mcid);
         }
         ft = it + cd;
     }
 }
 
-// Get generated PVT array
-void motorControl::PVTGet(const int ch, const QVector<long> p, const QVector<long> v, const QVector<int> t)
+// Get generated PVT array, used from the next stance phase after the
+// current trajectory has been run
+void motorControl::PVTGet(const int ch, const trajPtr p)
 {
     if (ch + 1 == mcid)
+        std::atomic_store(&next, p);
+}
+
+// A trajectory upload has finished
+void motorControl::loadedGet(const WORD id, const int tag, const bool ok)
+{
+    std::lock_guard<piMutex> guard(lock);
+
+    if (id == mcid && tag == gen)
+    {
+        loading = false;
+        armed = ok;
+    }
+}
+
+// A trajectory has started on the drive
+//   until: end of the trajectory from its actual start (monotonic ns)
+void motorControl::busyGet(const WORD id, const qint64 until)
+{
+    std::lock_guard<piMutex> guard(lock);
+
+    if (id == mcid)
+        idleStamp = std::max(idleStamp, until);
+}
+
+// Forget the heel-off events seen so far
+void cadenceEst::reset()
+{
+    last = 0;
+    period = 0;
+    count = 0;
+    rejected = 0;
+}
+
+// Add a heel-off event, true when the stride estimate is usable
+//   stamp: heel-off time (monotonic ns)
+bool cadenceEst::heelOff(const qint64 stamp)
+{
+    double interval = (stamp - last)*1e-9;
+
+    // A second detection within the same stride
+    if (last > 0 && interval < CADMIN)
+        return false;
+
+    // First step, or the wearer stopped
+    if (last == 0 || interval > CADMAX)
+    {
+        last = stamp;
+        period = 0;
+        count = 0;
+        rejected = 0;
+
+        return false;
+    }
+
+    last = stamp;
+
+    if (count > 0 && std::abs(interval - period) > CADDEV*period)
     {
-        P = p;
-        V = v;
-        T = t;
+        if (++rejected < CADLOST)
+            return false;
+
+        count = 0;
     }
+
+    rejected = 0;
+    period = count > 0 ? period + CADGAIN*(interval - period) : interval;
+    count++;
+
+    Log::print(LOG_DEBUG, "Heel-off stride %.3f s, estimate %.3f s", interval, period);
+
+    return count >= CADNUM;
 }
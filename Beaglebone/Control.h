@@ -2,47 +2,97 @@
 #define CONTROL_H
 
 #include <memory>
+#include <mutex>
 #include <QObject>
-#include <QElapsedTimer>
 
+#include "Channel.h"
 #include "PVT.h"
 #include "EPOS2.h"
+#include "Trace.h"
+
+#define CADMIN 0.5      // Shortest stride accepted by the cadence estimate (s)
+#define CADMAX 3.0      // Longest stride accepted by the cadence estimate (s)
+#define CADDEV 0.4      // Largest relative deviation of a stride from the estimate
+#define CADGAIN 0.3     // Weight of a new stride in the estimate
+#define CADNUM 3        // Strides before the estimate is reported
+#define CADLOST 3       // Rejected strides in a row that restart the estimate
+
+#define NFPER 10000000LL    // Frame period the minimum static frames are counted in (ns)
+
+// Stride period estimated from successive heel-off events of one leg
+// Strides far from the estimate (a missed or spurious heel-off) are skipped;
+// the estimate restarts when the wearer stops or changes pace abruptly.
+class cadenceEst
+{
+private:
+    qint64 last;        // Previous heel-off (monotonic ns, 0: none)
+    double period;      // Smoothed stride period (s)
+    int count;          // Strides in the estimate
+    int rejected;       // Strides rejected in a row
+
+public:
+    cadenceEst() { reset(); }
+
+    void reset();
+    bool heelOff(const qint64 stamp);
+
+    double stride() const { return period; }
+};
 
 // Functor that controls a motor depending on AHRS inputs
 class motorControl : public QObject {
     Q_OBJECT
 
 private:
-    static int nc;
-
     enum mode_t{STANCE, SWING};
 
     int mcid;
     mode_t mode;
-    QElapsedTimer timer;
-    QVector<long> P, V;
-    QVector<int> T;
+    qint64 swingStamp;
+    swingTrace trace;
+    cadenceEst cadence;
     std::shared_ptr<maxonMotor> motor_;
     double initOppAnk, initOwnAnk, pAcc, vAcc;
     double kr, ks, kw, cd, it, ft;
     double tw, tp, st, mt, t;
-    int nf, i = 0, sFrm = 0;
+    int nf;
+    qint64 staticStamp = 0;     // Start of the current static period (monotonic ns, 0: moving)
+
+    // Trajectory upload state: "armed" once the motor holds the current
+    // trajectory, "loading" while an upload is queued, "idleStamp" is the end
+    // of the last trajectory run (the IPM buffer cannot be cleared before),
+    // estimated when it is fired and corrected when the drive starts it
+    bool armed = false, loading = false;
+    int gen = 0;
+    qint64 idleStamp = 0;
+
+    // Trajectory in use by the state machine, and the latest one published,
+    // taken over between two trajectory runs
+    trajPtr traj, next;
+
+    // The state machine may run in the real-time thread while slots update
+    // parameters from the Qt thread, which must not hold it off
+    piMutex lock;
 
 public:
-    motorControl();
+    motorControl(const int id);
     ~motorControl();
 
-    void operator()(const double ownAnk, const double oppAnk, const double ownAcc);
+    void operator()(const qint64 stamp, const qint64 ownStamp, const double ownAnk, const double oppAnk,
+                    const double ownAcc);
     void setMotor(std::shared_ptr<maxonMotor> motor);
     void reset();
 
 signals:
-    void motorAdd(const WORD id, const long pos, const long vel, const BYTE dt);
-    void motorRun(const WORD id);
+    void motorLoad(const WORD id, const trajPtr traj, const int tag);
+    void motorRun(const WORD id, const swingTrace trace);
+    void motorCadence(const int ch, const double stride);
 
 public slots:
     void paramGet(const int ch, const int par, const double val);
-    void PVTGet(const int ch, const QVector<long> p, const QVector<long> v, const QVector<int> t);
+    void PVTGet(const int ch, const trajPtr p);
+    void loadedGet(const WORD id, const int tag, const bool ok);
+    void busyGet(const WORD id, const qint64 until);
 };
 
 #endif // CONTROL_H
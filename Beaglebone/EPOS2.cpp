@@ -1,45 +1,42 @@
-#include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <algorithm>
 #include <math.h>
 
 #include "EPOS2.h"
 #include "MotorConfig.h"
+#include "Log.h"
 
 // Initialize static constants
 const double maxonMotor::QC_PER_DEG = ENCR4X*GEARRT/360.0;
 
 // Initialize static variables
-HANDLE maxonMotor::keyHandle = 0;
 WORD maxonMotor::nMotors = 0;
+std::mt19937 maxonMotor::rng(std::random_device{}());
 
 // maxonMotor constructor
-maxonMotor::maxonMotor(const bool rev, const long offset) : reverse(rev), hoffset(offset), data(2)
+//   epos: bus scheduler owning the gateway
+//   state: homing references kept across restarts
+//   rec: download high-rate traces of each trajectory from the drive's data recorder
+maxonMotor::maxonMotor(eposBus &epos, homeState &state, const bool rev, const long offset, const char gains,
+                       const bool rec) :
+    reverse(rev), hoffset(offset), bus(epos), keyHandle(epos.handle()), homes(state), data(4), reading(false),
+    homing(false), parking(false), sensorFault(false), homeStart(0), sNext(0), sEnd(0), ipmSize(0), streaming(false),
+    streams(0), underflows(0), alive(new bool(true)),
+    recorder(rec), recArmed(false), recPending(false), recLater(false), recChannel(0), recCount(0), recSize(0),
+    recPeriod(RECPER), recStamp(0), recData(3)
 {
-    if (!keyHandle)
-    {
-        char dev[] = "EPOS2";
-#if RS232 == 1
-        char ptc[] = "MAXON_RS232";
-        char ifc[] = "RS232";
-        char prt[] = RS232PORT;
-#else
-        char ptc[] = "MAXON SERIAL V2";
-        char ifc[] = "USB";
-        char prt[] = "USB0";
-#endif
-        keyHandle = VCS_OpenDevice(dev, ptc, ifc, prt, &errid);
-    }
-
-    if (!keyHandle)
-        errChk(false);
+    // Increase motor counter and assign incremental motor number
+    motor = ++nMotors;
 
-    // Increase motor counter if successful
-    nMotors++;
-
-    // Assign incremental motor number
-    motor = nMotors;
+    // Configure the drive from the bus thread, the caller collects the result
+    // with waitSetup() so that other devices can be brought up meanwhile
+    configured = bus.post(BUS_COMMAND, [this, gains]() { setup(gains); });
+}
 
+// Clear errors and write motor and regulator parameters
+void maxonMotor::setup(const char gains)
+{
     // Display current error codes
     BYTE nErr = 0;
     DWORD errCode = 0;
@@ -54,8 +51,11 @@ maxonMotor::maxonMotor(const bool rev, const long offset) : reverse(rev), hoffse
             }
             errChk(VCS_GetDeviceErrorCode(keyHandle, motor, e, &errCode, &errid), false);
 
-            msg << " Error 0x" << std::hex << errCode << std::dec << std::endl;
-            printMsg();
+            Log::print(LOG_WARN, " Error 0x%x", errCode);
+
+            // Position sensor errors invalidate the homing reference
+            if ((errCode & 0xFF00) == 0x7300)
+                sensorFault = true;
         }
     }
 
@@ -63,15 +63,60 @@ maxonMotor::maxonMotor(const bool rev, const long offset) : reverse(rev), hoffse
     errChk(VCS_ClearFault(keyHandle, motor, &errid));
     errChk(VCS_SetDisableState(keyHandle, motor, &errid));
 
+    // The drive keeps its configuration while powered, read it back and
+    // write only the objects that differ
+    qint64 t0 = Clock::now();
+    int writes = 0;
+
     // Set general motor parameters
-    DWORD written;
+    WORD type;
+    errChk(VCS_GetMotorType(keyHandle, motor, &type, &errid));
+    if (type != MT_EC_BLOCK_COMMUTATED_MOTOR)
+    {
+        errChk(VCS_SetMotorType(keyHandle, motor, MT_EC_BLOCK_COMMUTATED_MOTOR, &errid));
+        writes++;
+    }
+
+    WORD nomCur, maxCur, thCons;
+    BYTE numPol;
+    errChk(VCS_GetEcMotorParameter(keyHandle, motor, &nomCur, &maxCur, &thCons, &numPol, &errid));
+    if (nomCur != NOMCUR || maxCur != MAXCUR || thCons != THCONS || numPol != NUMPOL)
+    {
+        errChk(VCS_SetEcMotorParameter(keyHandle, motor, NOMCUR, MAXCUR, THCONS, NUMPOL, &errid));
+        writes++;
+    }
+
+    DWORD count;
+    DWORD value = 0;
     DWORD maxVel = MAXVEL;
-    errChk(VCS_SetMotorType(keyHandle, motor, MT_EC_BLOCK_COMMUTATED_MOTOR, &errid));
-    errChk(VCS_SetEcMotorParameter(keyHandle, motor, NOMCUR, MAXCUR, THCONS, NUMPOL, &errid));
-    errChk(VCS_SetObject(keyHandle, motor, 0x6410, 0x04, &maxVel, sizeof maxVel, &written, &errid));
-    errChk(VCS_SetMaxProfileVelocity(keyHandle, motor, MAXVEL, &errid));
-    errChk(VCS_SetMaxAcceleration(keyHandle, motor, MAXACC, &errid));
-    errChk(VCS_SetMaxFollowingError(keyHandle, motor, 180*QC_PER_DEG, &errid));
+    errChk(VCS_GetObject(keyHandle, motor, 0x6410, 0x04, &value, sizeof value, &count, &errid));
+    if (value != maxVel)
+    {
+        errChk(VCS_SetObject(keyHandle, motor, 0x6410, 0x04, &maxVel, sizeof maxVel, &count, &errid));
+        writes++;
+    }
+
+    errChk(VCS_GetMaxProfileVelocity(keyHandle, motor, &value, &errid));
+    if (value != MAXVEL)
+    {
+        errChk(VCS_SetMaxProfileVelocity(keyHandle, motor, MAXVEL, &errid));
+        writes++;
+    }
+
+    errChk(VCS_GetMaxAcceleration(keyHandle, motor, &value, &errid));
+    if (value != MAXACC)
+    {
+        errChk(VCS_SetMaxAcceleration(keyHandle, motor, MAXACC, &errid));
+        writes++;
+    }
+
+    const DWORD maxErr = 180*QC_PER_DEG;
+    errChk(VCS_GetMaxFollowingError(keyHandle, motor, &value, &errid));
+    if (value != maxErr)
+    {
+        errChk(VCS_SetMaxFollowingError(keyHandle, motor, maxErr, &errid));
+        writes++;
+    }
 
     // Set the reverse rotation bit if necessary
     DWORD sConfig;
@@ -80,55 +125,91 @@ maxonMotor::maxonMotor(const bool rev, const long offset) : reverse(rev), hoffse
     else
         sConfig = 0;
 
-    errChk(VCS_SetSensorType(keyHandle, motor, ST_INC_ENCODER_2CHANNEL, &errid));
-    errChk(VCS_SetObject(keyHandle, motor, 0x2210, 0x04, &sConfig, sizeof sConfig, &written, &errid));
+    errChk(VCS_GetSensorType(keyHandle, motor, &type, &errid));
+    if (type != ST_INC_ENCODER_2CHANNEL)
+    {
+        errChk(VCS_SetSensorType(keyHandle, motor, ST_INC_ENCODER_2CHANNEL, &errid));
+        writes++;
+    }
+
+    errChk(VCS_GetObject(keyHandle, motor, 0x2210, 0x04, &value, sizeof value, &count, &errid));
+    if (value != sConfig)
+    {
+        errChk(VCS_SetObject(keyHandle, motor, 0x2210, 0x04, &sConfig, sizeof sConfig, &count, &errid));
+        writes++;
+    }
 
     // Set PID controller parameters
-    if (motor == 1)
+    const bool r = gains == 'R';
+    const WORD curP = r ? RCURPGAIN : LCURPGAIN, curI = r ? RCURIGAIN : LCURIGAIN;
+    const WORD spdP = r ? RSPDPGAIN : LSPDPGAIN, spdI = r ? RSPDIGAIN : LSPDIGAIN;
+    const WORD spdVel = r ? RSPDFFVEL : LSPDFFVEL, spdAcc = r ? RSPDFFACC : LSPDFFACC;
+    const WORD posP = r ? RPOSPGAIN : LPOSPGAIN, posI = r ? RPOSIGAIN : LPOSIGAIN, posD = r ? RPOSDGAIN : LPOSDGAIN;
+    const WORD posVel = r ? RPOSFFVEL : LPOSFFVEL, posAcc = r ? RPOSFFACC : LPOSFFACC;
+    WORD p, i, d;
+
+    errChk(VCS_GetCurrentRegulatorGain(keyHandle, motor, &p, &i, &errid));
+    if (p != curP || i != curI)
     {
-        errChk(VCS_SetCurrentRegulatorGain(keyHandle, motor, RCURPGAIN, RCURIGAIN, &errid));
-
-        errChk(VCS_SetVelocityRegulatorGain(keyHandle, motor, RSPDPGAIN, RSPDIGAIN, &errid));
-        errChk(VCS_SetVelocityRegulatorFeedForward(keyHandle, motor, RSPDFFVEL, RSPDFFACC, &errid));
+        errChk(VCS_SetCurrentRegulatorGain(keyHandle, motor, curP, curI, &errid));
+        writes++;
+    }
 
-        errChk(VCS_SetPositionRegulatorGain(keyHandle, motor, RPOSPGAIN, RPOSIGAIN, RPOSDGAIN, &errid));
-        errChk(VCS_SetPositionRegulatorFeedForward(keyHandle, motor, RPOSFFVEL, RPOSFFACC, &errid));
+    errChk(VCS_GetVelocityRegulatorGain(keyHandle, motor, &p, &i, &errid));
+    if (p != spdP || i != spdI)
+    {
+        errChk(VCS_SetVelocityRegulatorGain(keyHandle, motor, spdP, spdI, &errid));
+        writes++;
     }
-    else
+
+    errChk(VCS_GetVelocityRegulatorFeedForward(keyHandle, motor, &p, &i, &errid));
+    if (p != spdVel || i != spdAcc)
     {
-        errChk(VCS_SetCurrentRegulatorGain(keyHandle, motor, LCURPGAIN, LCURIGAIN, &errid));
+        errChk(VCS_SetVelocityRegulatorFeedForward(keyHandle, motor, spdVel, spdAcc, &errid));
+        writes++;
+    }
 
-        errChk(VCS_SetVelocityRegulatorGain(keyHandle, motor, LSPDPGAIN, LSPDIGAIN, &errid));
-        errChk(VCS_SetVelocityRegulatorFeedForward(keyHandle, motor, LSPDFFVEL, LSPDFFACC, &errid));
+    errChk(VCS_GetPositionRegulatorGain(keyHandle, motor, &p, &i, &d, &errid));
+    if (p != posP || i != posI || d != posD)
+    {
+        errChk(VCS_SetPositionRegulatorGain(keyHandle, motor, posP, posI, posD, &errid));
+        writes++;
+    }
 
-        errChk(VCS_SetPositionRegulatorGain(keyHandle, motor, LPOSPGAIN, LPOSIGAIN, LPOSDGAIN, &errid));
-        errChk(VCS_SetPositionRegulatorFeedForward(keyHandle, motor, LPOSFFVEL, LPOSFFACC, &errid));
+    errChk(VCS_GetPositionRegulatorFeedForward(keyHandle, motor, &p, &i, &errid));
+    if (p != posVel || i != posAcc)
+    {
+        errChk(VCS_SetPositionRegulatorFeedForward(keyHandle, motor, posVel, posAcc, &errid));
+        writes++;
     }
+
+    Log::print(LOG_INFO, "Motor %d configured in %lld ms, %d of %d parameter groups written", motor,
+               (Clock::now() - t0)/1000000, writes, NPARGRP);
+}
+
+// Wait until the drive is configured, passing on setup errors
+void maxonMotor::waitSetup()
+{
+    if (configured.valid())
+        configured.get();
 }
 
 // maxonMotor destructor
 maxonMotor::~maxonMotor()
 {
-    if (keyHandle)
+    bus.post(BUS_COMMAND, [this]()
     {
-        errChk(VCS_SetDisableState(keyHandle, motor, &errid));
-        nMotors--;
-
-        if (nMotors == 0)
-        {
-            msg << "EPOS2 cleared" << std::endl;
-            printMsg();
-
-            keyHandle = 0;
-        }
-    }
+        alive.reset();
+        errChk(VCS_SetDisableState(keyHandle, motor, &errid), false);
+    }).wait();
+    nMotors--;
 }
 
-// Output the contents of buffer "msg" and clear
+// Pass the contents of buffer "msg" to the logger and clear
 void maxonMotor::printMsg()
 {
-    std::cout << msg.rdbuf() << std::flush;
-    msg.clear();
+    Log::text(LOG_INFO, msg.str());
+    msg.str("");
 }
 
 // EPOS2 error parser
@@ -139,8 +220,7 @@ void maxonMotor::errChk(BOOL success, BOOL fatal)
         char errBuff[100];
         if (VCS_GetErrorInfo(errid, errBuff, 100))
         {
-            msg << "EPOS2 error " << errid << " (" << errBuff << ")" << std::endl;
-            printMsg();
+            Log::print(LOG_ERROR, "EPOS2 error %u (%s)", errid, errBuff);
 
             if (fatal)
                 throw "EPOS2";
@@ -149,8 +229,90 @@ void maxonMotor::errChk(BOOL success, BOOL fatal)
     }
 }
 
-// Enable motor and find home position
+// Queue a request whose completion nobody waits for
+// Requests still queued when the motor is destroyed are skipped. Errors are
+// caught in the bus thread and reported with the "fault" signal, the drive
+// is left alone until the next homing
+void maxonMotor::submit(const busPrio prio, std::function<void()> job, const qint64 due)
+{
+    std::weak_ptr<bool> token = alive;
+
+    bus.post(prio, [this, token, job]()
+    {
+        if (token.expired())
+            return;
+
+        try
+        {
+            job();
+        }
+        catch (const char *e)
+        {
+            streaming = false;
+            homing = false;
+            parking = false;
+
+            Log::print(LOG_ERROR, "Motor %d: %s request failed", motor, e);
+
+            emit fault(motor);
+        }
+    }, due);
+}
+
+// Enable motor, homing at the end stop unless the drive kept its reference,
+// all drives home concurrently
 void maxonMotor::home()
+{
+    submit(BUS_COMMAND, [this]()
+    {
+        if (warmCheck())
+            park();
+        else
+            search();
+    });
+}
+
+// Check whether the drive kept the reference of a previous homing: it was
+// not reset since (the token is still there), it homed with the same offset,
+// its encoder reported no error and it is not beyond the end stop
+bool maxonMotor::warmCheck()
+{
+    homeRef ref;
+    bool fault = sensorFault;
+    sensorFault = false;
+
+    if (!homes.get(motor, ref))
+        return false;
+
+    DWORD token = 0, count;
+    errChk(VCS_GetObject(keyHandle, motor, WARMOBJ, 0x00, &token, sizeof token, &count, &errid));
+    errChk(VCS_GetPositionIs(keyHandle, motor, &qcs, &errid));
+
+    const char *reason = nullptr;
+
+    if (token != ref.token)
+        reason = "drive was reset";
+    else if (ref.offset != hoffset)
+        reason = "homing offset changed";
+    else if (fault)
+        reason = "position sensor error";
+    else if (qcs < -hoffset - WARMTOL*QC_PER_DEG)
+        reason = "position beyond the end stop";
+
+    if (reason)
+    {
+        Log::print(LOG_INFO, "Motor %d needs homing: %s", motor, reason);
+        homes.clear(motor);
+        return false;
+    }
+
+    Log::print(LOG_INFO, "Motor %d kept its home reference, at %.1f deg (%.1f deg when saved)", motor,
+               qcs/QC_PER_DEG, ref.position/QC_PER_DEG);
+    return true;
+}
+
+// Search the home position at the mechanical end stop
+void maxonMotor::search()
 {
     msg << "Motor " << motor << " homing" << std::endl;
     printMsg();
@@ -163,102 +325,587 @@ void maxonMotor::home()
     errChk(VCS_ActivateHomingMode(keyHandle, motor, &errid));
     errChk(VCS_SetEnableState(keyHandle, motor, &errid));
     errChk(VCS_FindHome(keyHandle, motor, HM_CURRENT_THRESHOLD_NEGATIVE_SPEED, &errid));
-    errChk(VCS_WaitForHomingAttained(keyHandle, motor, HOMTMO, &errid));
+
+    homing = true;
+    homeStart = Clock::now();
+    homeWait();
+}
+
+// Return to the home position of a kept reference along a cosine profile
+// that peaks at WARMVEL, in interpolated position mode
+void maxonMotor::park()
+{
+    errChk(VCS_ClearFault(keyHandle, motor, &errid));
+
+    errChk(VCS_SetOperationMode(keyHandle, motor, OMD_INTERPOLATED_POSITION_MODE, &errid));
+    errChk(VCS_ActivateInterpolatedPositionMode(keyHandle, motor, &errid));
+    errChk(VCS_ClearIpmBuffer(keyHandle, motor, &errid));
+    errChk(VCS_SetEnableState(keyHandle, motor, &errid));
+    errChk(VCS_GetPositionIs(keyHandle, motor, &qcs, &errid));
+
+    homeStart = Clock::now();
+
+    double dist = -qcs;
+    double duration = M_PI/2*std::abs(dist)/(WARMVEL*QC_PER_DEG);
+
+    DWORD freeBuff;
+    errChk(VCS_GetFreeIpmBufferSize(keyHandle, motor, &freeBuff, &errid));
+
+    // Segments of at most 250 ms, keeping a buffer slot for the end point
+    int n = std::max(1, static_cast<int>(ceil(duration/0.25)));
+    if (n > static_cast<int>(freeBuff) - 1)
+    {
+        Log::print(LOG_WARN, "Motor %d is too far from home (%.1f deg)", motor, qcs/QC_PER_DEG);
+        search();
+        return;
+    }
+
+    if (std::abs(dist) > 1)
+    {
+        int T = std::max(1, static_cast<int>(duration*1000/n + 0.5));
+        duration = n*T/1000.0;
+
+        for (int k = 1; k <= n; k++)
+        {
+            double s = static_cast<double>(k)/n;
+            long p = lround(qcs + dist*(1 - cos(M_PI*s))/2);
+            long v = lround(dist*M_PI/(2*duration)*sin(M_PI*s)*60/ENCR4X);
+
+            errChk(VCS_AddPvtValueToIpmBuffer(keyHandle, motor, p, v, static_cast<BYTE>(T), &errid));
+        }
+
+        errChk(VCS_AddPvtValueToIpmBuffer(keyHandle, motor, 0, 0, 0, &errid));
+        errChk(VCS_StartIpmTrajectory(keyHandle, motor, &errid));
+    }
+
+    parking = true;
+    parkWait();
+}
+
+// Poll the return to home without blocking the bus
+void maxonMotor::parkWait()
+{
+    if (!parking)
+        return;
+
+    BOOL running, underflowWarn, overflowWarn, velWarn, accWarn, underflowErr, overflowErr, velErr, accErr;
+    errChk(VCS_GetIpmStatus(keyHandle, motor, &running, &underflowWarn, &overflowWarn, &velWarn, &accWarn,
+                            &underflowErr, &overflowErr, &velErr, &accErr, &errid));
+
+    BOOL fault;
+    errChk(VCS_GetFaultState(keyHandle, motor, &fault, &errid));
+
+    if (running && !fault)
+    {
+        submit(BUS_COMMAND, [this]() { parkWait(); }, Clock::now() + HOMPOL*1000000LL);
+        return;
+    }
+
+    parking = false;
+
+    if (fault || underflowErr)
+    {
+        Log::print(LOG_WARN, "Motor %d failed to return home, searching the end stop", motor);
+        search();
+        return;
+    }
+
+    errChk(VCS_ClearIpmBuffer(keyHandle, motor, &errid));
+
+    if (recorder)
+        recConfig();
+
+    Log::print(LOG_INFO, "Motor %d ready, returned home in %lld ms without homing", motor,
+               (Clock::now() - homeStart)/1000000);
+
+    emit ready();
+}
+
+// Poll the homing state without blocking the bus, then activate the
+// interpolated position mode
+void maxonMotor::homeWait()
+{
+    if (!homing)
+        return;
+
+    BOOL attained, failed;
+    errChk(VCS_GetHomingState(keyHandle, motor, &attained, &failed, &errid));
+
+    qint64 elapsed = (Clock::now() - homeStart)/1000000;
+
+    if (failed || (!attained && elapsed > HOMTMO))
+    {
+        homing = false;
+        Log::print(LOG_ERROR, "Motor %d homing %s after %lld ms", motor, failed ? "failed" : "timed out", elapsed);
+
+        // Leave the drive disabled without a reference, the startup waits for this motor otherwise
+        errChk(VCS_SetDisableState(keyHandle, motor, &errid), false);
+        homes.clear(motor);
+        emit fault(motor);
+        return;
+    }
+
+    if (!attained)
+    {
+        submit(BUS_COMMAND, [this]() { homeWait(); }, Clock::now() + HOMPOL*1000000LL);
+        return;
+    }
+
+    homing = false;
+
+    // Leave a token in a volatile object, it is lost if the drive is reset
+    DWORD token = std::uniform_int_distribution<DWORD>(1)(rng), count;
+    errChk(VCS_SetObject(keyHandle, motor, WARMOBJ, 0x00, &token, sizeof token, &count, &errid));
+    homes.set(motor, homeRef{token, hoffset, 0});
 
     // Activate interpolated position mode
     errChk(VCS_SetOperationMode(keyHandle, motor, OMD_INTERPOLATED_POSITION_MODE, &errid));
     errChk(VCS_ActivateInterpolatedPositionMode(keyHandle, motor, &errid));
     errChk(VCS_ClearIpmBuffer(keyHandle, motor, &errid));
 
-    msg << "Motor " << motor << " ready" << std::endl;
-    printMsg();
+    if (recorder)
+        recConfig();
+
+    Log::print(LOG_INFO, "Motor %d ready, homed in %lld ms", motor, elapsed);
 
     emit ready();
 }
 
 // Motor data storage
-void maxonMotor::read(double t)
+void maxonMotor::read()
 {
-    // Get actual position
-    errChk(VCS_GetPositionIs(keyHandle, motor, &qcs, &errid));
-    double pos = static_cast<double>(qcs) / QC_PER_DEG;
+    // Skip the request while the previous one is still queued
+    if (reading.exchange(true))
+        return;
+
+    submit(BUS_TELEMETRY, [this]()
+    {
+        reading = false;
 
-    data[0].push_back(t);
-    data[1].push_back(pos);
+        // Get actual position, stamped at the middle of the bus round trip
+        qint64 t0 = Clock::now();
+        errChk(VCS_GetPositionIs(keyHandle, motor, &qcs, &errid));
+        qint64 stamp = t0 + (Clock::now() - t0)/2;
 
-    emit sendData(motor, pos);
+        double pos = static_cast<double>(qcs) / QC_PER_DEG;
+
+        data[0].push_back(Clock::seconds(stamp));
+        data[1].push_back(pos);
+        data[2].push_back(NAN);
+        data[3].push_back(NAN);
+
+        slot.write(motorSample{stamp, pos});
+    });
 }
 
-// Add PVT point to IPM buffer
-void maxonMotor::addPVT(WORD m, long pos, long vel, BYTE dt)
+// Upload a PVT trajectory to the IPM buffer in one burst
+// Points that do not fit are streamed while the trajectory runs
+//   tag: returned with the "loaded" signal to match replies with requests
+void maxonMotor::addTrajectory(WORD m, const trajPtr traj, const int tag)
 {
     if (m == motor)
+        submit(BUS_UPLOAD, [this, traj, tag]() { load(traj, tag); });
+}
+
+// Upload from the bus thread, once the previous trajectory has been run
+void maxonMotor::load(const trajPtr traj, const int tag)
+{
+    // Clearing the buffer would cut short a trajectory that started late
+    BOOL running, underflowWarn, overflowWarn, velWarn, accWarn, underflowErr, overflowErr, velErr, accErr;
+    errChk(VCS_GetIpmStatus(keyHandle, motor, &running, &underflowWarn, &overflowWarn, &velWarn, &accWarn,
+                            &underflowErr, &overflowErr, &velErr, &accErr, &errid));
+
+    if (running)
     {
-        errChk(VCS_AddPvtValueToIpmBuffer(keyHandle, motor, pos, vel, dt, &errid));
+        qint64 now = Clock::now();
 
-        msg << "Sending PVT: ";
-        msg << std::setw(5) << pos << std::setw(6) << vel << std::setw(5) << (int)dt;
-        msg << " to motor " << motor;
+        Log::print(LOG_DEBUG, "Motor %d still running a trajectory, upload delayed by %lld ms", motor,
+                   std::max(0LL, sEnd - now)/1000000);
 
-        if (dt == 0)
-        {
-            DWORD freeBuff;
-            errChk(VCS_GetFreeIpmBufferSize(keyHandle, motor, &freeBuff, &errid));
-            msg << " (" << freeBuff << " free) " << std::endl;
-        }
-        else
-            msg << std::endl;
+        submit(BUS_UPLOAD, [this, traj, tag]() { load(traj, tag); }, std::max(sEnd, now + IPMPOL*1000000LL));
+        return;
+    }
 
-        printMsg();
+    qint64 t0 = Clock::now();
+    DWORD freeBuff;
+
+    // The previous trajectory has been executed, drop any stale points
+    errChk(VCS_ClearIpmBuffer(keyHandle, motor, &errid));
+    errChk(VCS_GetFreeIpmBufferSize(keyHandle, motor, &freeBuff, &errid));
+
+    ipmSize = freeBuff;
+    streaming = false;
+
+    if (freeBuff < 2 || traj->T.isEmpty())
+    {
+        Log::print(LOG_ERROR, "IPM buffer of motor %d cannot hold a trajectory (%u free)", motor, freeBuff);
+
+        emit loaded(motor, tag, false);
+        return;
     }
+
+    sTraj = traj;
+    sNext = 0;
+
+    int n = upload(freeBuff);
+
+    Log::print(LOG_INFO, "Loaded %d of %d PVT points to motor %d in %lld us (%u free)", n, traj->T.size(),
+               motor, (Clock::now() - t0)/1000, freeBuff - n);
+
+    // The recorder keeps the previous trajectory until it has been
+    // downloaded, it is armed for this one afterwards
+    if (recorder && !recPending)
+        recArm(traj->duration);
+
+    recLater = recorder && recPending;
+
+    emit loaded(motor, tag, true);
 }
 
 // Motor go-to-position command
-void maxonMotor::runIPM(WORD m)
+//   trace: swing timestamps so far, completed with the bus hops and logged
+void maxonMotor::runIPM(WORD m, swingTrace trace)
 {
     if (m == motor)
     {
-        errChk(VCS_StartIpmTrajectory(keyHandle, motor, &errid));
+        trace.post = Clock::now();
 
-        msg << "Starting IPM on motor " << motor << std::endl;
-        printMsg();
+        submit(BUS_COMMAND, [this, trace]() mutable
+        {
+            trace.start = Clock::now();
+            errChk(VCS_StartIpmTrajectory(keyHandle, motor, &errid));
+            trace.done = Clock::now();
+
+            // The buffer is busy until the trajectory has been run from its actual start
+            if (sTraj)
+            {
+                sEnd = trace.start + (trace.done - trace.start)/2 + sTraj->duration*1000000;
+                emit busy(motor, sEnd);
+            }
+
+            // The recorder triggers on the movement start, stamped like position reads,
+            // its contents are downloaded after the post-roll
+            if (recLater)
+            {
+                recLater = false;
+                Log::print(LOG_DEBUG, "Motor %d: previous recording not downloaded yet, trajectory not recorded",
+                           motor);
+            }
+
+            if (recArmed)
+            {
+                recArmed = false;
+                recPending = true;
+                recChannel = 0;
+                recTraj = sTraj;
+                recStamp = trace.start + (trace.done - trace.start)/2;
+
+                submit(BUS_TELEMETRY, [this]() { recRead(); }, recStamp + (sTraj->duration + RECPOST)*1000000LL);
+            }
+
+            Trace::swing(trace);
+
+            if (sTraj && sNext < sTraj->T.size())
+            {
+                streaming = true;
+                streams++;
+                refill();
+            }
+        });
+    }
+}
+
+// Add up to n pending trajectory points to the IPM buffer
+int maxonMotor::upload(const DWORD n)
+{
+    const trajectory &tr = *sTraj;
+    int i;
+
+    for (i = 0; i < static_cast<int>(n) && sNext < tr.T.size(); i++, sNext++)
+        errChk(VCS_AddPvtValueToIpmBuffer(keyHandle, motor, tr.P[sNext], tr.V[sNext], static_cast<BYTE>(tr.T[sNext]),
+                                          &errid));
+
+    return i;
+}
+
+// Top up the IPM buffer of a streamed trajectory
+// Called again when half of the buffered time has been executed
+void maxonMotor::refill()
+{
+    if (!streaming)
+        return;
+
+    const trajectory &tr = *sTraj;
+
+    BOOL running, underflowWarn, overflowWarn, velWarn, accWarn, underflowErr, overflowErr, velErr, accErr;
+    errChk(VCS_GetIpmStatus(keyHandle, motor, &running, &underflowWarn, &overflowWarn, &velWarn, &accWarn,
+                            &underflowErr, &overflowErr, &velErr, &accErr, &errid));
+
+    if (underflowErr || !running)
+    {
+        streaming = false;
+        underflows++;
+
+        Log::print(LOG_ERROR, "IPM underflow on motor %d after %d of %d points", motor, sNext, tr.T.size());
+        return;
+    }
+
+    if (underflowWarn)
+        Log::print(LOG_WARN, "IPM buffer of motor %d running low at point %d", motor, sNext);
+
+    DWORD freeBuff;
+    errChk(VCS_GetFreeIpmBufferSize(keyHandle, motor, &freeBuff, &errid));
+
+    upload(freeBuff);
+
+    if (sNext >= tr.T.size())
+    {
+        streaming = false;
+        return;
+    }
+
+    // Time held in the buffer (ms)
+    int held = 0;
+    for (int i = std::max(0, sNext - static_cast<int>(ipmSize)); i < sNext; i++)
+        held += tr.T[i];
+
+    submit(BUS_UPLOAD, [this]() { refill(); }, Clock::now() + std::max(1, held/2)*1000000LL);
+}
+
+// Demand position of a trajectory (qc) at time t (s) after its start,
+// interpolated like the drive does from rest at home
+double maxonMotor::demand(const trajectory &tr, const double t)
+{
+    double p0 = 0, v0 = 0, t0 = 0;
+
+
+    for (int i = 0; i < tr.T.size() && tr.T[i] > 0; i++)
+    {
+        double dt = tr.T[i]/1000.0;
+        double p1 = tr.P[i];
+        double v1 = tr.V[i]*ENCR4X/60.0;
+
+        if (t <= t0 + dt)
+        {
+            double s = t - t0;
+            double a = (2*(p0 - p1) + dt*(v0 + v1))/pow(dt, 3);
+            double b = (3*(p1 - p0) - dt*(2*v0 + v1))/pow(dt, 2);
+
+            return p0 + s*(v0 + s*(b + s*a));
+        }
+
+        p0 = p1;
+        v0 = v1;
+        t0 += dt;
+    }
+
+    return p0;
+}
+
+// Set up the data recorder: position, velocity and current, started by the
+// next trajectory
+void maxonMotor::recConfig()
+{
+    errChk(VCS_DisableAllTriggers(keyHandle, motor, &errid));
+    errChk(VCS_EnableTrigger(keyHandle, motor, DR_MOVEMENT_START_TRIGGER, &errid));
+
+    errChk(VCS_DeactivateAllChannels(keyHandle, motor, &errid));
+    errChk(VCS_ActivateChannel(keyHandle, motor, 1, 0x6064, 0x00, 4, &errid)); // Position actual value
+    errChk(VCS_ActivateChannel(keyHandle, motor, 2, 0x606C, 0x00, 4, &errid)); // Velocity actual value
+    errChk(VCS_ActivateChannel(keyHandle, motor, 3, 0x6078, 0x00, 2, &errid)); // Current actual value
+
+    errChk(VCS_ReadChannelVectorSize(keyHandle, motor, &recSize, &errid));
+
+    Log::print(LOG_INFO, "Motor %d data recorder: %u samples per channel", motor, recSize);
+}
+
+// Arm the recorder for a trajectory, with the fastest rate that covers it
+//   duration: trajectory length (ms)
+void maxonMotor::recArm(const int duration)
+{
+    if (recSize <= RECPRE)
+        return;
+
+    // Stop recording in time for a new one after a trajectory has run
+    if (recArmed)
+        errChk(VCS_StopRecorder(keyHandle, motor, &errid));
+
+    // Keep recording past the end of the trajectory
+    int period = ((duration + RECPOST)*10 + recSize - RECPRE - 1)/(recSize - RECPRE);
+    recPeriod = std::max(period, RECPER);
+
+    errChk(VCS_SetRecorderParameter(keyHandle, motor, recPeriod, RECPRE, &errid));
+    errChk(VCS_StartRecorder(keyHandle, motor, &errid));
+
+    recArmed = true;
+}
+
+// Download the recording of the last trajectory, one channel per telemetry
+// request so that commands are not held up, and merge it into the log
+//   all: download the remaining channels at once
+void maxonMotor::recRead(const bool all)
+{
+    if (!recPending)
+        return;
+
+    if (recChannel == 0)
+    {
+        BOOL triggered, running;
+        errChk(VCS_IsRecorderTriggered(keyHandle, motor, &triggered, &errid));
+        errChk(VCS_IsRecorderRunning(keyHandle, motor, &running, &errid));
+
+        if (running)
+            errChk(VCS_StopRecorder(keyHandle, motor, &errid));
+
+        if (!triggered)
+        {
+            recPending = false;
+            return;
+        }
+
+        // Samples recorded until now, the recorder stops by itself when full
+        qint64 period = static_cast<qint64>(recPeriod)*100000;
+        recCount = std::min<qint64>(recSize, (Clock::now() - recStamp)/period + RECPRE + 1);
+    }
+
+    static const BYTE size[3] = {4, 4, 2};
+    std::vector<BYTE> raw(recSize*4);
+
+    do
+    {
+        const int c = recChannel;
+        qint64 t0 = Clock::now();
+
+        errChk(VCS_ReadChannelDataVector(keyHandle, motor, c + 1, raw.data(), recSize*size[c], &errid));
+
+        recData[c].resize(recCount);
+        for (qint64 i = 0; i < recCount; i++)
+        {
+            const BYTE *b = &raw[i*size[c]];
+
+            if (size[c] == 4)
+                recData[c][i] = static_cast<qint32>(b[0] | b[1] << 8 | b[2] << 16 | static_cast<quint32>(b[3]) << 24);
+            else
+                recData[c][i] = static_cast<qint16>(b[0] | b[1] << 8);
+        }
+
+        Log::print(LOG_DEBUG, "Read recorder channel %d of motor %d in %lld us", c + 1, motor,
+                   (Clock::now() - t0)/1000);
+    }
+    while (++recChannel < 3 && all);
+
+    if (recChannel < 3)
+    {
+        submit(BUS_TELEMETRY, [this]() { recRead(); });
+        return;
+    }
+
+    recMerge();
+    recPending = false;
+
+    // A trajectory uploaded meanwhile has not started yet
+    if (recLater)
+    {
+        recLater = false;
+        recArm(sTraj->duration);
     }
 }
 
+// Merge a downloaded recording into the log
+void maxonMotor::recMerge()
+{
+    const std::vector<std::vector<double> > &ch = recData;
+    const qint64 n = recCount;
+    qint64 period = static_cast<qint64>(recPeriod)*100000;
+
+    // Sample RECPRE was taken at the trajectory start
+    for (qint64 i = 0; i < n; i++)
+    {
+        data[0].push_back(Clock::seconds(recStamp + (i - RECPRE)*period));
+        data[1].push_back(ch[0][i]/QC_PER_DEG);
+        data[2].push_back(ch[1][i]*6/GEARRT);
+        data[3].push_back(ch[2][i]);
+    }
+
+    Log::print(LOG_INFO, "Read %lld recorder samples at %.1f ms from motor %d", n, recPeriod/10.0, motor);
+
+    // Tracking error against the demanded trajectory
+    double sum = 0, max = 0;
+    qint64 cnt = 0;
+
+    for (qint64 i = RECPRE; i < n; i++)
+    {
+        double err = std::abs(ch[0][i] - demand(*recTraj, (i - RECPRE)*period*1e-9))/QC_PER_DEG;
+
+        sum += err*err;
+        max = std::max(max, err);
+        cnt++;
+    }
+
+    if (cnt > 0)
+        Log::print(LOG_INFO, "Motor %d tracking error over %d points: rms %.3f deg, max %.3f deg",
+                   motor, recTraj->T.size(), sqrt(sum/cnt), max);
+}
+
 // Dump sensor data to file
 void maxonMotor::dump(const std::string pathDate)
 {
+    // Take the samples recorded by the bus thread, including the last trajectory
+    std::vector<std::vector<double> > rec(4);
+    bus.post(BUS_TELEMETRY, [this, &rec]()
+    {
+        recRead(true);
+        rec.swap(data);
+    }).wait();
+
+    // Recorder samples are appended after the polled ones, sort by time
+    std::vector<size_t> row(rec[0].size());
+    for (size_t i = 0; i < row.size(); i++)
+        row[i] = i;
+
+    std::stable_sort(row.begin(), row.end(), [&rec](size_t a, size_t b) { return rec[0][a] < rec[0][b]; });
+
     std::string file = pathDate + "-Mtr" + std::to_string(motor) + ".txt";
     std::ofstream outFile(file);
 
     if (outFile.is_open())
     {
-        msg << "Writing motor " << motor << " data to " << file << std::endl;
-        printMsg();
+        Log::print(LOG_INFO, "Writing motor %d data to %s", motor, file.c_str());
 
         outFile << std::setprecision(8) << std::fixed;
-        for (uint i = 0; i < data[0].size(); i++)
+        for (uint i = 0; i < row.size(); i++)
         {
-            for (uint c = 0; c < data.size(); c++)
-                outFile << std::setw(16) << data[c][i];
+            for (uint c = 0; c < rec.size(); c++)
+                outFile << std::setw(16) << rec[c][row[i]];
 
             outFile << std::endl;
         }
         outFile.close();
     }
-
-    for (uint i = 0; i < data.size(); i++)
-        data[i].resize(0);    
 }
 
 // Disable motor
 void maxonMotor::stop()
 {
-    if (keyHandle)
+    submit(BUS_COMMAND, [this]()
     {
+        streaming = false;
+        homing = false;
+        parking = false;
         errChk(VCS_SetDisableState(keyHandle, motor, &errid));
 
+        // Keep the last position with the homing reference
+        homeRef ref;
+        if (homes.get(motor, ref) && VCS_GetPositionIs(keyHandle, motor, &qcs, &errid))
+        {
+            ref.position = qcs;
+            homes.set(motor, ref);
+        }
+
+        if (streams > 0)
+            Log::print(LOG_INFO, "Motor %d: %lu streamed trajectories, %lu underflows", motor, streams, underflows);
+
         msg << "Motor " << motor << " disabled" << std::endl;
         printMsg();
-    }
+    });
 }
@@ -1,21 +1,32 @@
 #ifndef EPOS2_H
 #define EPOS2_H
 
+#include <atomic>
+#include <future>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <QObject>
 #include <QVector>
 
-typedef unsigned char BYTE;
-typedef unsigned short WORD;
-typedef unsigned int DWORD;
-typedef void* HANDLE;
-typedef int BOOL;
+#include "Bus.h"
+#include "Channel.h"
+#include "Clock.h"
+#include "HomeState.h"
+#include "PVT.h"
+#include "Trace.h"
 
-#include "Definitions.h"
+// Motor sample passed to the control loop
+struct motorSample
+{
+    qint64 stamp;       // Capture time (monotonic ns)
+    double pos;         // Output angle (deg)
+};
 
 // Maxon EPOS2 motor class
+// Slots only queue requests on the bus scheduler, which runs them in its thread
 class maxonMotor : public QObject {
     Q_OBJECT
 
@@ -24,8 +35,12 @@ private:
     long hoffset;
 
     static const double QC_PER_DEG;
-    static HANDLE keyHandle;
     static WORD nMotors;
+    static std::mt19937 rng;
+
+    eposBus &bus;
+    HANDLE keyHandle;
+    homeState &homes;
 
     std::vector<std::vector<double> > data;
     std::stringstream msg;
@@ -33,22 +48,77 @@ private:
     WORD motor;
     int qcs;
 
+    latestSlot<motorSample> slot;
+    std::atomic<bool> reading;  // A telemetry read is queued
+
+    std::future<void> configured;   // Drive setup queued by the constructor
+    bool homing;                    // Waiting for the drive to reach home, bus thread only
+    bool parking;                   // Returning to a kept home position, bus thread only
+    bool sensorFault;               // Position sensor error found at setup
+    qint64 homeStart;               // Homing start time (monotonic ns)
+
+    // Trajectory streamed to the IPM buffer, used from the bus thread only
+    trajPtr sTraj;
+    int sNext;                  // Next point to upload
+    qint64 sEnd;                // End of the trajectory run last (monotonic ns)
+    DWORD ipmSize;              // IPM buffer capacity
+    bool streaming;             // Refilling the running trajectory
+    unsigned long streams, underflows;
+    std::shared_ptr<bool> alive;    // Expires when queued requests must not run
+
+    // Onboard data recorder, used from the bus thread only
+    bool recorder;              // Record each trajectory on the drive
+    bool recArmed;              // Waiting for a trajectory
+    bool recPending;            // A recording is to be downloaded
+    bool recLater;              // Arm once the pending recording has been downloaded
+    int recChannel;             // Next channel to download
+    qint64 recCount;            // Samples per channel of the recording
+    DWORD recSize;              // Samples per channel
+    WORD recPeriod;             // Sampling period (multiples of 0.1 ms)
+    qint64 recStamp;            // Trajectory start time (monotonic ns)
+    trajPtr recTraj;            // Trajectory recorded
+    std::vector<std::vector<double> > recData;  // Channels downloaded so far
+
     void printMsg();
+    void submit(const busPrio prio, std::function<void()> job, const qint64 due = 0);
     void errChk(BOOL success, BOOL fatal = true);
+    void setup(const char gains);
+    bool warmCheck();
+    void search();
+    void homeWait();
+    void park();
+    void parkWait();
+
+    void load(const trajPtr traj, const int tag);
+    int upload(const DWORD n);
+    void refill();
+    double demand(const trajectory &tr, const double t);
+
+    void recConfig();
+    void recArm(const int duration);
+    void recRead(const bool all = false);
+    void recMerge();
 
 public:
-    maxonMotor(const bool rev, const long offset = 0);
+    maxonMotor(eposBus &epos, homeState &state, const bool rev, const long offset = 0, const char gains = 'R',
+               const bool rec = false);
     ~maxonMotor();
 
+    void waitSetup();
+
+    const latestSlot<motorSample> &latest() const { return slot; }
+
 signals:
     void ready();
-    void sendData(const WORD id, const double out);
+    void loaded(const WORD id, const int tag, const bool ok);
+    void fault(const WORD id);
+    void busy(const WORD id, const qint64 until);
 
 public slots:
     void home();
-    void read(double t);
-    void addPVT(const WORD id, const long pos, const long vel, const BYTE dt);
-    void runIPM(const WORD id);
+    void read();
+    void addTrajectory(const WORD id, const trajPtr traj, const int tag);
+    void runIPM(const WORD id, swingTrace trace);
     void dump(const std::string pathDate);
     void stop();
 };
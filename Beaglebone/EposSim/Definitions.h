@@ -0,0 +1,107 @@
+// Stand-in for the EposCmd library header, used with "qmake CONFIG+=epossim"
+// Declares the subset of the VCS_* API used by Orthosis, implemented by the
+// drive simulator in EposSim.cpp. Types are defined by the including file.
+
+#ifndef EPOSSIM_DEFINITIONS_H
+#define EPOSSIM_DEFINITIONS_H
+
+// Operation modes
+#define OMD_PROFILE_POSITION_MODE           1
+#define OMD_PROFILE_VELOCITY_MODE           3
+#define OMD_HOMING_MODE                     6
+#define OMD_INTERPOLATED_POSITION_MODE      7
+#define OMD_POSITION_MODE                   -1
+
+// Motor and sensor types
+#define MT_DC_MOTOR                         1
+#define MT_EC_SINUS_COMMUTATED_MOTOR        10
+#define MT_EC_BLOCK_COMMUTATED_MOTOR        11
+#define ST_INC_ENCODER_3CHANNEL             1
+#define ST_INC_ENCODER_2CHANNEL             2
+
+// Homing methods
+#define HM_CURRENT_THRESHOLD_POSITIVE_SPEED -3
+#define HM_CURRENT_THRESHOLD_NEGATIVE_SPEED -4
+
+// Data recorder triggers
+#define DR_MOVEMENT_START_TRIGGER           1
+#define DR_ERROR_TRIGGER                    2
+#define DR_DIGITAL_INPUT_TRIGGER            4
+#define DR_MOVEMENT_END_TRIGGER             8
+
+// Communication
+HANDLE VCS_OpenDevice(char *DeviceName, char *ProtocolStackName, char *InterfaceName, char *PortName, DWORD *pErrorCode);
+BOOL VCS_CloseDevice(HANDLE KeyHandle, DWORD *pErrorCode);
+BOOL VCS_GetErrorInfo(DWORD ErrorCodeValue, char *pErrorInfo, WORD MaxStrSize);
+
+// Faults and state
+BOOL VCS_GetNbOfDeviceError(HANDLE KeyHandle, WORD NodeId, BYTE *pNbDeviceError, DWORD *pErrorCode);
+BOOL VCS_GetDeviceErrorCode(HANDLE KeyHandle, WORD NodeId, BYTE DeviceErrorNumber, DWORD *pDeviceErrorCode, DWORD *pErrorCode);
+BOOL VCS_GetFaultState(HANDLE KeyHandle, WORD NodeId, BOOL *pIsInFault, DWORD *pErrorCode);
+BOOL VCS_ClearFault(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_SetEnableState(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_SetDisableState(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+
+// Configuration
+BOOL VCS_SetObject(HANDLE KeyHandle, WORD NodeId, WORD ObjectIndex, BYTE ObjectSubIndex, void *pData, DWORD NbOfBytesToWrite, DWORD *pNbOfBytesWritten, DWORD *pErrorCode);
+BOOL VCS_GetObject(HANDLE KeyHandle, WORD NodeId, WORD ObjectIndex, BYTE ObjectSubIndex, void *pData, DWORD NbOfBytesToRead, DWORD *pNbOfBytesRead, DWORD *pErrorCode);
+BOOL VCS_SetMotorType(HANDLE KeyHandle, WORD NodeId, WORD MotorType, DWORD *pErrorCode);
+BOOL VCS_GetMotorType(HANDLE KeyHandle, WORD NodeId, WORD *pMotorType, DWORD *pErrorCode);
+BOOL VCS_SetEcMotorParameter(HANDLE KeyHandle, WORD NodeId, WORD NominalCurrent, WORD MaxOutputCurrent, WORD ThermalTimeConstant, BYTE NbOfPolePairs, DWORD *pErrorCode);
+BOOL VCS_GetEcMotorParameter(HANDLE KeyHandle, WORD NodeId, WORD *pNominalCurrent, WORD *pMaxOutputCurrent, WORD *pThermalTimeConstant, BYTE *pNbOfPolePairs, DWORD *pErrorCode);
+BOOL VCS_SetSensorType(HANDLE KeyHandle, WORD NodeId, WORD SensorType, DWORD *pErrorCode);
+BOOL VCS_GetSensorType(HANDLE KeyHandle, WORD NodeId, WORD *pSensorType, DWORD *pErrorCode);
+BOOL VCS_SetMaxProfileVelocity(HANDLE KeyHandle, WORD NodeId, DWORD MaxProfileVelocity, DWORD *pErrorCode);
+BOOL VCS_GetMaxProfileVelocity(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxProfileVelocity, DWORD *pErrorCode);
+BOOL VCS_SetMaxAcceleration(HANDLE KeyHandle, WORD NodeId, DWORD MaxAcceleration, DWORD *pErrorCode);
+BOOL VCS_GetMaxAcceleration(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxAcceleration, DWORD *pErrorCode);
+BOOL VCS_SetMaxFollowingError(HANDLE KeyHandle, WORD NodeId, DWORD MaxFollowingError, DWORD *pErrorCode);
+BOOL VCS_GetMaxFollowingError(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxFollowingError, DWORD *pErrorCode);
+BOOL VCS_SetCurrentRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, DWORD *pErrorCode);
+BOOL VCS_GetCurrentRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, DWORD *pErrorCode);
+BOOL VCS_SetVelocityRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, DWORD *pErrorCode);
+BOOL VCS_GetVelocityRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, DWORD *pErrorCode);
+BOOL VCS_SetVelocityRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD VelocityFeedForward, WORD AccelerationFeedForward, DWORD *pErrorCode);
+BOOL VCS_GetVelocityRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD *pVelocityFeedForward, WORD *pAccelerationFeedForward, DWORD *pErrorCode);
+BOOL VCS_SetPositionRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, WORD D, DWORD *pErrorCode);
+BOOL VCS_GetPositionRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, WORD *pD, DWORD *pErrorCode);
+BOOL VCS_SetPositionRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD VelocityFeedForward, WORD AccelerationFeedForward, DWORD *pErrorCode);
+BOOL VCS_GetPositionRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD *pVelocityFeedForward, WORD *pAccelerationFeedForward, DWORD *pErrorCode);
+BOOL VCS_SetOperationMode(HANDLE KeyHandle, WORD NodeId, char OperationMode, DWORD *pErrorCode);
+
+// Homing
+BOOL VCS_SetHomingParameter(HANDLE KeyHandle, WORD NodeId, DWORD HomingAcceleration, DWORD SpeedSwitch, DWORD SpeedIndex, int HomeOffset, WORD CurrentThreshold, int HomePosition, DWORD *pErrorCode);
+BOOL VCS_ActivateHomingMode(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_FindHome(HANDLE KeyHandle, WORD NodeId, char HomingMethod, DWORD *pErrorCode);
+BOOL VCS_WaitForHomingAttained(HANDLE KeyHandle, WORD NodeId, DWORD Timeout, DWORD *pErrorCode);
+BOOL VCS_GetHomingState(HANDLE KeyHandle, WORD NodeId, BOOL *pHomingAttained, BOOL *pHomingError, DWORD *pErrorCode);
+
+// Interpolated position mode
+BOOL VCS_ActivateInterpolatedPositionMode(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_GetFreeIpmBufferSize(HANDLE KeyHandle, WORD NodeId, DWORD *pBufferSize, DWORD *pErrorCode);
+BOOL VCS_ClearIpmBuffer(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_AddPvtValueToIpmBuffer(HANDLE KeyHandle, WORD NodeId, int Position, int Velocity, BYTE Time, DWORD *pErrorCode);
+BOOL VCS_StartIpmTrajectory(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_StopIpmTrajectory(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_GetIpmStatus(HANDLE KeyHandle, WORD NodeId, BOOL *pTrajectoryRunning, BOOL *pIsUnderflowWarning, BOOL *pIsOverflowWarning, BOOL *pIsVelocityWarning, BOOL *pIsAccelerationWarning, BOOL *pIsUnderflowError, BOOL *pIsOverflowError, BOOL *pIsVelocityError, BOOL *pIsAccelerationError, DWORD *pErrorCode);
+
+// Motion info
+BOOL VCS_GetPositionIs(HANDLE KeyHandle, WORD NodeId, int *pPositionIs, DWORD *pErrorCode);
+BOOL VCS_GetVelocityIs(HANDLE KeyHandle, WORD NodeId, int *pVelocityIs, DWORD *pErrorCode);
+BOOL VCS_GetCurrentIs(HANDLE KeyHandle, WORD NodeId, short *pCurrentIs, DWORD *pErrorCode);
+BOOL VCS_GetMovementState(HANDLE KeyHandle, WORD NodeId, BOOL *pTargetReached, DWORD *pErrorCode);
+
+// Data recorder
+BOOL VCS_SetRecorderParameter(HANDLE KeyHandle, WORD NodeId, WORD SamplingPeriod, WORD NbOfPrecedingSamples, DWORD *pErrorCode);
+BOOL VCS_EnableTrigger(HANDLE KeyHandle, WORD NodeId, BYTE TriggerType, DWORD *pErrorCode);
+BOOL VCS_DisableAllTriggers(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_ActivateChannel(HANDLE KeyHandle, WORD NodeId, BYTE ChannelNumber, WORD ObjectIndex, BYTE ObjectSubIndex, BYTE ObjectSize, DWORD *pErrorCode);
+BOOL VCS_DeactivateAllChannels(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_StartRecorder(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_StopRecorder(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode);
+BOOL VCS_IsRecorderRunning(HANDLE KeyHandle, WORD NodeId, BOOL *pRunning, DWORD *pErrorCode);
+BOOL VCS_IsRecorderTriggered(HANDLE KeyHandle, WORD NodeId, BOOL *pTriggered, DWORD *pErrorCode);
+BOOL VCS_ReadChannelVectorSize(HANDLE KeyHandle, WORD NodeId, DWORD *pVectorSize, DWORD *pErrorCode);
+BOOL VCS_ReadChannelDataVector(HANDLE KeyHandle, WORD NodeId, BYTE ChannelNumber, BYTE *pDataVectorBuffer, DWORD VectorBufferSize, DWORD *pErrorCode);
+
+#endif // EPOSSIM_DEFINITIONS_H
@@ -0,0 +1,1192 @@
+// EPOS2 drive simulator implementing the VCS_* calls used by Orthosis
+//
+// Each node is an EC motor with a position regulator, current and acceleration
+// limits and a mechanical end stop below the home position, plus a data
+// recorder sampling the position, velocity and current objects. The model is
+// integrated in fixed steps up to the current time whenever a call reaches
+// the drive. Every call takes a configurable bus latency, bulk reads also a
+// per-byte transfer time:
+//   EPOSSIM_NODES       number of drives (default 2)
+//   EPOSSIM_LATENCY     mean call latency in us (default 1000)
+//   EPOSSIM_JITTER      uniform latency jitter in us (default 200)
+//   EPOSSIM_STATE       file keeping the position and configuration objects of
+//                       the drives from VCS_CloseDevice to the next VCS_OpenDevice,
+//                       as if they had stayed powered
+//
+// PVT points follow the convention of PVT::check(): the time of a point is the
+// length of the segment that ends at it, the first segment starts at the
+// demand position at rest, and a point with null time ends the trajectory.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef void* HANDLE;
+typedef int BOOL;
+
+#include "Definitions.h"
+
+#define SIM_QPR     4096        // Encoder quadcounts per motor revolution
+#define SIM_STEP    0.00025     // Integration step (s)
+#define SIM_WN      (2*M_PI*25) // Position loop natural frequency (rad/s)
+#define SIM_ZETA    0.9         // Position loop damping
+#define SIM_IPMSIZE 64          // IPM buffer size (points)
+#define SIM_STOP    30000       // End stop distance below the power-up position (qc)
+#define SIM_RECMEM  2048        // Data recorder memory (samples, shared by the channels)
+#define SIM_RECBASE 0.0001      // Data recorder base sampling period (s)
+#define SIM_RECCH   4           // Data recorder channels
+#define SIM_BYTE    2e-6        // Bulk transfer time per byte (s)
+
+// Communication error codes
+#define SIM_OK          0x00000000
+#define SIM_E_HANDLE    0x10000008
+#define SIM_E_NODE      0x10000009
+#define SIM_E_STATE     0x34000007
+#define SIM_E_TIMEOUT   0x1000000B
+#define SIM_E_OVERFLOW  0x10000010
+#define SIM_E_PARAM     0x10000011
+
+// Device error codes
+#define SIM_D_FOLLOWING 0x8611
+#define SIM_D_IPM       0x8A88
+
+namespace {
+
+struct pvtPoint
+{
+    double p, v, t;             // qc, qc/s, s
+};
+
+struct recChannel
+{
+    WORD index;
+    BYTE sub, size;
+};
+
+struct drive
+{
+    // Configuration
+    double maxVel = 12500*SIM_QPR/60.0;     // qc/s
+    double maxAcc = 1e6*SIM_QPR/60.0;       // qc/s^2
+    double maxFollow = 2000;                // qc
+    double maxCur = 5000;                   // mA
+    double inertia = 0.0;                   // mA per qc/s^2
+
+    double homAcc = 0, homSwitch = 0, homIndex = 0, homOffset = 0, homCur = 0, homPos = 0;
+    std::map<DWORD, DWORD> od;              // Configuration objects, key index << 8 | sub
+
+    // State
+    bool enabled = false, fault = false;
+    char mode = 0;
+    double p = 0, v = 0, cur = 0;           // Actual position, velocity, current
+    double pd = 0, vd = 0;                  // Demand position and velocity
+    double stop = -SIM_STOP;                // Mechanical end stop
+    std::vector<DWORD> errors;              // Device error history, newest first
+
+    // Homing: 0 idle, 1 search, 2 offset move, 3 attained
+    int homing = 0;
+    double target = 0;
+
+    // Interpolated position mode
+    std::deque<pvtPoint> ipm;
+    bool running = false, underflow = false, overflow = false;
+    pvtPoint from, to;
+    double segT = 0;
+
+    // Data recorder
+    recChannel chan[SIM_RECCH] = {};
+    int nchan = 0;
+    double recPeriod = 0.001;
+    size_t recPre = 0;
+    BYTE triggers = 0;
+    bool recRunning = false, recTriggered = false;
+    double recNext = 0;
+    std::deque<std::vector<int> > rec;      // One row per sample
+
+    double last = 0;                        // Model time (s)
+};
+
+std::mutex simLock;
+std::vector<drive> drives;
+bool opened = false;
+double latency = 1e-3, jitter = 2e-4;
+std::mt19937 rng(1);
+
+const auto t0 = std::chrono::steady_clock::now();
+
+double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+double envDouble(const char *name, const double def)
+{
+    const char *s = getenv(name);
+    return s ? atof(s) : def;
+}
+
+// Samples per recorder channel
+size_t recSize(const drive &d)
+{
+    return d.nchan > 0 ? SIM_RECMEM/d.nchan : SIM_RECMEM;
+}
+
+// Trigger the data recorder if it waits for the given event
+void trigger(drive &d, const BYTE type)
+{
+    if (d.recRunning && !d.recTriggered && (d.triggers & type))
+    {
+        d.recTriggered = true;
+        d.recNext = d.last;
+    }
+}
+
+// Value of an object sampled by the recorder
+int object(const drive &d, const WORD index)
+{
+    switch (index)
+    {
+    case 0x6064: return static_cast<int>(std::lround(d.p));
+    case 0x606C: return static_cast<int>(std::lround(d.v*60.0/SIM_QPR));
+    case 0x6078: return static_cast<int>(std::lround(d.cur));
+    default:     return 0;
+    }
+}
+
+// Configuration object, zero until written
+DWORD &param(drive &d, const WORD index, const BYTE sub)
+{
+    return d.od[static_cast<DWORD>(index) << 8 | sub];
+}
+
+// Record one sample per period, keep the preceding samples until triggered
+void record(drive &d)
+{
+    while (d.recRunning && d.recNext <= d.last)
+    {
+        std::vector<int> row(d.nchan);
+        for (int c = 0; c < d.nchan; c++)
+            row[c] = object(d, d.chan[c].index);
+
+        d.rec.push_back(row);
+        d.recNext += d.recPeriod;
+
+        if (!d.recTriggered)
+        {
+            while (d.rec.size() > d.recPre)
+                d.rec.pop_front();
+        }
+        else if (d.rec.size() >= recSize(d))
+            d.recRunning = false;
+    }
+}
+
+// Latch a device error and disable the power stage
+void setFault(drive &d, const DWORD code)
+{
+    trigger(d, DR_ERROR_TRIGGER);
+
+    d.fault = true;
+    d.enabled = false;
+    d.running = false;
+    d.homing = 0;
+    d.errors.insert(d.errors.begin(), code);
+}
+
+// Start the next PVT segment, false when the trajectory is over
+bool nextSegment(drive &d)
+{
+    if (d.ipm.empty())
+    {
+        // Ran out of points without the terminating one
+        d.underflow = true;
+        setFault(d, SIM_D_IPM);
+        return false;
+    }
+
+    pvtPoint pt = d.ipm.front();
+    d.ipm.pop_front();
+
+    if (pt.t <= 0)
+    {
+        d.running = false;
+        d.vd = 0;
+        return false;
+    }
+
+    d.from = pvtPoint{d.pd, d.vd, 0};
+    d.to = pt;
+    d.segT = 0;
+
+    return true;
+}
+
+// Demand trajectory generators
+void demand(drive &d, const double dt)
+{
+    if (d.mode == OMD_HOMING_MODE && d.homing == 1)
+    {
+        // Search the end stop at switch speed
+        d.vd = std::max(d.vd - d.homAcc*dt, -d.homSwitch);
+        d.pd += d.vd*dt;
+    }
+    else if (d.mode == OMD_HOMING_MODE && d.homing == 2)
+    {
+        // Move away from the stop at index speed
+        double dist = d.target - d.pd;
+        double step = d.homIndex*dt;
+
+        if (std::abs(dist) <= step)
+        {
+            d.pd = d.target;
+            d.vd = 0;
+
+            // Home reached, shift the position register
+            double shift = d.homPos - d.pd;
+            d.p += shift;
+            d.pd += shift;
+            d.stop += shift;
+            d.homing = 3;
+        }
+        else
+        {
+            d.vd = dist > 0 ? d.homIndex : -d.homIndex;
+            d.pd += d.vd*dt;
+        }
+    }
+    else if (d.mode == OMD_INTERPOLATED_POSITION_MODE && d.running)
+    {
+        d.segT += dt;
+
+        while (d.running && d.segT >= d.to.t)
+        {
+            d.segT -= d.to.t;
+            d.pd = d.to.p;
+            d.vd = d.to.v;
+
+            if (!nextSegment(d))
+                return;
+        }
+
+        // Cubic Hermite interpolation between the segment end points
+        double T = d.to.t, s = d.segT;
+        double a = (2*(d.from.p - d.to.p) + T*(d.from.v + d.to.v))/(T*T*T);
+        double b = (3*(d.to.p - d.from.p) - T*(2*d.from.v + d.to.v))/(T*T);
+
+        d.pd = d.from.p + s*(d.from.v + s*(b + s*a));
+        d.vd = d.from.v + s*(2*b + 3*a*s);
+    }
+    else
+        d.vd = 0;
+}
+
+// Advance one drive to time t
+void advance(drive &d, const double t)
+{
+    // Nothing moves while disabled and at rest
+    if (!d.enabled && d.v == 0 && !d.recRunning)
+        d.last = t;
+
+    while (d.last + SIM_STEP <= t)
+    {
+        const double dt = SIM_STEP;
+        double acc;
+
+        if (d.enabled)
+        {
+            demand(d, dt);
+
+            // Position regulator with acceleration and current limits
+            acc = SIM_WN*SIM_WN*(d.pd - d.p) + 2*SIM_ZETA*SIM_WN*(d.vd - d.v);
+            acc = std::max(-d.maxAcc, std::min(d.maxAcc, acc));
+
+            d.cur = std::max(-d.maxCur, std::min(d.maxCur, acc*d.inertia));
+            acc = d.cur/d.inertia;
+        }
+        else
+        {
+            // Coasting with viscous friction
+            acc = -20*d.v;
+            d.cur = 0;
+        }
+
+        d.v = std::max(-d.maxVel, std::min(d.maxVel, d.v + acc*dt));
+        d.p += d.v*dt;
+
+        if (std::abs(d.v) < 1 && !d.enabled)
+            d.v = 0;
+
+        // Mechanical end stop
+        if (d.p <= d.stop)
+        {
+            d.p = d.stop;
+            if (d.v < 0)
+                d.v = 0;
+        }
+
+        // Current threshold homing
+        if (d.homing == 1 && -d.cur >= d.homCur)
+        {
+            d.pd = d.p;
+            d.vd = 0;
+            d.target = d.p + d.homOffset;
+            d.homing = 2;
+        }
+
+        if (d.enabled && d.homing != 1 && std::abs(d.pd - d.p) > d.maxFollow)
+            setFault(d, SIM_D_FOLLOWING);
+
+        d.last += dt;
+
+        record(d);
+    }
+}
+
+// Common entry: bus latency, handle and node checks, model update
+// Returns the drive with the simulator locked, or null with the error code set
+drive *getDrive(HANDLE h, const WORD node, DWORD *err, std::unique_lock<std::mutex> &lk)
+{
+    double delay;
+    {
+        std::lock_guard<std::mutex> g(simLock);
+        delay = latency + jitter*std::uniform_real_distribution<double>(-1, 1)(rng);
+    }
+
+    if (delay > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(delay));
+
+    lk = std::unique_lock<std::mutex>(simLock);
+
+    if (!opened || h != static_cast<HANDLE>(&drives))
+    {
+        *err = SIM_E_HANDLE;
+        return nullptr;
+    }
+
+    if (node < 1 || node > drives.size())
+    {
+        *err = SIM_E_NODE;
+        return nullptr;
+    }
+
+    drive &d = drives[node - 1];
+    advance(d, now());
+
+    *err = SIM_OK;
+    return &d;
+}
+
+// Result of a call that needs an enabled drive without fault
+BOOL ready(drive &d, DWORD *err)
+{
+    if (d.fault || !d.enabled)
+    {
+        *err = SIM_E_STATE;
+        return 0;
+    }
+
+    return 1;
+}
+
+// Restore the drives saved by saveState()
+void loadState(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    if (!f)
+        return;
+
+    size_t i, n;
+    double p, stop;
+
+    while (fscanf(f, "drive %zu %lf %lf %zu\n", &i, &p, &stop, &n) == 4 && i < drives.size())
+    {
+        drives[i].p = p;
+        drives[i].stop = stop;
+
+        DWORD key, value;
+        for (size_t k = 0; k < n && fscanf(f, "%x %x\n", &key, &value) == 2; k++)
+            drives[i].od[key] = value;
+    }
+
+    fclose(f);
+}
+
+// Keep the position and configuration of the drives for the next session
+void saveState(const char *file)
+{
+    FILE *f = fopen(file, "w");
+    if (!f)
+        return;
+
+    for (size_t i = 0; i < drives.size(); i++)
+    {
+        advance(drives[i], now());
+        fprintf(f, "drive %zu %.3f %.3f %zu\n", i, drives[i].p, drives[i].stop, drives[i].od.size());
+
+        for (const auto &o : drives[i].od)
+            fprintf(f, "%x %x\n", o.first, o.second);
+    }
+
+    fclose(f);
+}
+
+}
+
+#define ACCESS(h, n, e) \
+    std::unique_lock<std::mutex> lk; \
+    drive *d = getDrive(h, n, e, lk); \
+    if (!d) return 0
+
+HANDLE VCS_OpenDevice(char *, char *, char *, char *, DWORD *pErrorCode)
+{
+    std::lock_guard<std::mutex> g(simLock);
+
+    int n = static_cast<int>(envDouble("EPOSSIM_NODES", 2));
+    latency = envDouble("EPOSSIM_LATENCY", 1000)*1e-6;
+    jitter = envDouble("EPOSSIM_JITTER", 200)*1e-6;
+
+    drives.assign(n > 0 ? n : 1, drive());
+
+    const char *state = getenv("EPOSSIM_STATE");
+    if (state)
+        loadState(state);
+
+    double t = now();
+    for (size_t i = 0; i < drives.size(); i++)
+    {
+        drive &d = drives[i];
+
+        // Restored limits take effect as if they had been written
+        if (d.od.count(0x641002))
+            d.maxCur = d.od[0x641002];
+        if (d.od.count(0x607F00))
+            d.maxVel = d.od[0x607F00]*SIM_QPR/60.0;
+        if (d.od.count(0x60C500))
+            d.maxAcc = d.od[0x60C500]*SIM_QPR/60.0;
+        if (d.od.count(0x606500))
+            d.maxFollow = d.od[0x606500];
+
+        d.last = t;
+        d.inertia = d.maxCur/d.maxAcc;
+    }
+
+    opened = true;
+    *pErrorCode = SIM_OK;
+
+    fprintf(stderr, "EposSim: %zu drives, %.0f us latency\n", drives.size(), latency*1e6);
+
+    return static_cast<HANDLE>(&drives);
+}
+
+BOOL VCS_CloseDevice(HANDLE KeyHandle, DWORD *pErrorCode)
+{
+    std::lock_guard<std::mutex> g(simLock);
+
+    if (!opened || KeyHandle != static_cast<HANDLE>(&drives))
+    {
+        *pErrorCode = SIM_E_HANDLE;
+        return 0;
+    }
+
+    const char *state = getenv("EPOSSIM_STATE");
+    if (state)
+        saveState(state);
+
+    opened = false;
+    *pErrorCode = SIM_OK;
+    return 1;
+}
+
+BOOL VCS_GetErrorInfo(DWORD ErrorCodeValue, char *pErrorInfo, WORD MaxStrSize)
+{
+    const char *s;
+
+    switch (ErrorCodeValue)
+    {
+    case SIM_OK:         s = "No error"; break;
+    case SIM_E_HANDLE:   s = "Bad handle"; break;
+    case SIM_E_NODE:     s = "Node not found"; break;
+    case SIM_E_STATE:    s = "Device is disabled or in fault state"; break;
+    case SIM_E_TIMEOUT:  s = "Timeout"; break;
+    case SIM_E_OVERFLOW: s = "IPM buffer full"; break;
+    case SIM_E_PARAM:    s = "Bad parameter"; break;
+    default:
+        return 0;
+    }
+
+    snprintf(pErrorInfo, MaxStrSize, "%s", s);
+    return 1;
+}
+
+BOOL VCS_GetNbOfDeviceError(HANDLE KeyHandle, WORD NodeId, BYTE *pNbDeviceError, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pNbDeviceError = static_cast<BYTE>(std::min<size_t>(d->errors.size(), 255));
+    return 1;
+}
+
+BOOL VCS_GetDeviceErrorCode(HANDLE KeyHandle, WORD NodeId, BYTE DeviceErrorNumber, DWORD *pDeviceErrorCode, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (DeviceErrorNumber < 1 || DeviceErrorNumber > d->errors.size())
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    *pDeviceErrorCode = d->errors[DeviceErrorNumber - 1];
+    return 1;
+}
+
+BOOL VCS_GetFaultState(HANDLE KeyHandle, WORD NodeId, BOOL *pIsInFault, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pIsInFault = d->fault;
+    return 1;
+}
+
+BOOL VCS_ClearFault(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->fault = false;
+    d->underflow = false;
+    d->overflow = false;
+    d->errors.clear();
+    return 1;
+}
+
+BOOL VCS_SetEnableState(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (d->fault)
+    {
+        *pErrorCode = SIM_E_STATE;
+        return 0;
+    }
+
+    if (!d->enabled)
+    {
+        d->enabled = true;
+        d->pd = d->p;
+        d->vd = 0;
+    }
+    return 1;
+}
+
+BOOL VCS_SetDisableState(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->enabled = false;
+    d->running = false;
+    d->homing = 0;
+    return 1;
+}
+
+BOOL VCS_SetObject(HANDLE KeyHandle, WORD NodeId, WORD ObjectIndex, BYTE ObjectSubIndex, void *pData, DWORD NbOfBytesToWrite, DWORD *pNbOfBytesWritten, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (NbOfBytesToWrite > sizeof(DWORD))
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    DWORD value = 0;
+    memcpy(&value, pData, NbOfBytesToWrite);
+    param(*d, ObjectIndex, ObjectSubIndex) = value;
+
+    *pNbOfBytesWritten = NbOfBytesToWrite;
+    return 1;
+}
+
+BOOL VCS_GetObject(HANDLE KeyHandle, WORD NodeId, WORD ObjectIndex, BYTE ObjectSubIndex, void *pData, DWORD NbOfBytesToRead, DWORD *pNbOfBytesRead, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (NbOfBytesToRead > sizeof(DWORD))
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    DWORD value;
+    switch (ObjectIndex)
+    {
+    case 0x6064: case 0x606C: case 0x6078:
+        value = static_cast<DWORD>(object(*d, ObjectIndex));
+        break;
+    default:
+        value = param(*d, ObjectIndex, ObjectSubIndex);
+    }
+
+    memcpy(pData, &value, NbOfBytesToRead);
+    *pNbOfBytesRead = NbOfBytesToRead;
+    return 1;
+}
+
+BOOL VCS_SetMotorType(HANDLE KeyHandle, WORD NodeId, WORD MotorType, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x6402, 0x00) = MotorType;
+    return 1;
+}
+
+BOOL VCS_GetMotorType(HANDLE KeyHandle, WORD NodeId, WORD *pMotorType, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pMotorType = param(*d, 0x6402, 0x00);
+    return 1;
+}
+
+BOOL VCS_SetEcMotorParameter(HANDLE KeyHandle, WORD NodeId, WORD NominalCurrent, WORD MaxOutputCurrent, WORD ThermalTimeConstant, BYTE NbOfPolePairs, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x6410, 0x01) = NominalCurrent;
+    param(*d, 0x6410, 0x02) = MaxOutputCurrent;
+    param(*d, 0x6410, 0x03) = NbOfPolePairs;
+    param(*d, 0x6410, 0x05) = ThermalTimeConstant;
+
+    d->maxCur = MaxOutputCurrent;
+    d->inertia = d->maxCur/d->maxAcc;
+    return 1;
+}
+
+BOOL VCS_GetEcMotorParameter(HANDLE KeyHandle, WORD NodeId, WORD *pNominalCurrent, WORD *pMaxOutputCurrent, WORD *pThermalTimeConstant, BYTE *pNbOfPolePairs, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pNominalCurrent = param(*d, 0x6410, 0x01);
+    *pMaxOutputCurrent = param(*d, 0x6410, 0x02);
+    *pNbOfPolePairs = param(*d, 0x6410, 0x03);
+    *pThermalTimeConstant = param(*d, 0x6410, 0x05);
+    return 1;
+}
+
+BOOL VCS_SetSensorType(HANDLE KeyHandle, WORD NodeId, WORD SensorType, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x2210, 0x02) = SensorType;
+    return 1;
+}
+
+BOOL VCS_GetSensorType(HANDLE KeyHandle, WORD NodeId, WORD *pSensorType, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pSensorType = param(*d, 0x2210, 0x02);
+    return 1;
+}
+
+BOOL VCS_SetMaxProfileVelocity(HANDLE KeyHandle, WORD NodeId, DWORD MaxProfileVelocity, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x607F, 0x00) = MaxProfileVelocity;
+    d->maxVel = MaxProfileVelocity*SIM_QPR/60.0;
+    return 1;
+}
+
+BOOL VCS_GetMaxProfileVelocity(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxProfileVelocity, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pMaxProfileVelocity = param(*d, 0x607F, 0x00);
+    return 1;
+}
+
+BOOL VCS_SetMaxAcceleration(HANDLE KeyHandle, WORD NodeId, DWORD MaxAcceleration, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60C5, 0x00) = MaxAcceleration;
+    d->maxAcc = MaxAcceleration*SIM_QPR/60.0;
+    d->inertia = d->maxCur/d->maxAcc;
+    return 1;
+}
+
+BOOL VCS_GetMaxAcceleration(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxAcceleration, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pMaxAcceleration = param(*d, 0x60C5, 0x00);
+    return 1;
+}
+
+BOOL VCS_SetMaxFollowingError(HANDLE KeyHandle, WORD NodeId, DWORD MaxFollowingError, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x6065, 0x00) = MaxFollowingError;
+    d->maxFollow = MaxFollowingError;
+    return 1;
+}
+
+BOOL VCS_GetMaxFollowingError(HANDLE KeyHandle, WORD NodeId, DWORD *pMaxFollowingError, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pMaxFollowingError = param(*d, 0x6065, 0x00);
+    return 1;
+}
+
+BOOL VCS_SetCurrentRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60F6, 0x01) = P;
+    param(*d, 0x60F6, 0x02) = I;
+    return 1;
+}
+
+BOOL VCS_GetCurrentRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pP = param(*d, 0x60F6, 0x01);
+    *pI = param(*d, 0x60F6, 0x02);
+    return 1;
+}
+
+BOOL VCS_SetVelocityRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60F9, 0x01) = P;
+    param(*d, 0x60F9, 0x02) = I;
+    return 1;
+}
+
+BOOL VCS_GetVelocityRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pP = param(*d, 0x60F9, 0x01);
+    *pI = param(*d, 0x60F9, 0x02);
+    return 1;
+}
+
+BOOL VCS_SetVelocityRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD VelocityFeedForward, WORD AccelerationFeedForward, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60F9, 0x04) = VelocityFeedForward;
+    param(*d, 0x60F9, 0x05) = AccelerationFeedForward;
+    return 1;
+}
+
+BOOL VCS_GetVelocityRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD *pVelocityFeedForward, WORD *pAccelerationFeedForward, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pVelocityFeedForward = param(*d, 0x60F9, 0x04);
+    *pAccelerationFeedForward = param(*d, 0x60F9, 0x05);
+    return 1;
+}
+
+BOOL VCS_SetPositionRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD P, WORD I, WORD D, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60FB, 0x01) = P;
+    param(*d, 0x60FB, 0x02) = I;
+    param(*d, 0x60FB, 0x03) = D;
+    return 1;
+}
+
+BOOL VCS_GetPositionRegulatorGain(HANDLE KeyHandle, WORD NodeId, WORD *pP, WORD *pI, WORD *pD, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pP = param(*d, 0x60FB, 0x01);
+    *pI = param(*d, 0x60FB, 0x02);
+    *pD = param(*d, 0x60FB, 0x03);
+    return 1;
+}
+
+BOOL VCS_SetPositionRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD VelocityFeedForward, WORD AccelerationFeedForward, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    param(*d, 0x60FB, 0x04) = VelocityFeedForward;
+    param(*d, 0x60FB, 0x05) = AccelerationFeedForward;
+    return 1;
+}
+
+BOOL VCS_GetPositionRegulatorFeedForward(HANDLE KeyHandle, WORD NodeId, WORD *pVelocityFeedForward, WORD *pAccelerationFeedForward, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pVelocityFeedForward = param(*d, 0x60FB, 0x04);
+    *pAccelerationFeedForward = param(*d, 0x60FB, 0x05);
+    return 1;
+}
+
+BOOL VCS_SetOperationMode(HANDLE KeyHandle, WORD NodeId, char OperationMode, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (OperationMode != OMD_HOMING_MODE && OperationMode != OMD_INTERPOLATED_POSITION_MODE)
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    d->mode = OperationMode;
+    d->running = false;
+    d->homing = 0;
+    d->pd = d->p;
+    d->vd = 0;
+    return 1;
+}
+
+BOOL VCS_SetHomingParameter(HANDLE KeyHandle, WORD NodeId, DWORD HomingAcceleration, DWORD SpeedSwitch, DWORD SpeedIndex, int HomeOffset, WORD CurrentThreshold, int HomePosition, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->homAcc = HomingAcceleration*SIM_QPR/60.0;
+    d->homSwitch = SpeedSwitch*SIM_QPR/60.0;
+    d->homIndex = SpeedIndex*SIM_QPR/60.0;
+    d->homOffset = HomeOffset;
+    d->homCur = CurrentThreshold;
+    d->homPos = HomePosition;
+    param(*d, 0x2081, 0x00) = HomePosition;
+    return 1;
+}
+
+BOOL VCS_ActivateHomingMode(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    return VCS_SetOperationMode(KeyHandle, NodeId, OMD_HOMING_MODE, pErrorCode);
+}
+
+BOOL VCS_FindHome(HANDLE KeyHandle, WORD NodeId, char HomingMethod, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (!ready(*d, pErrorCode))
+        return 0;
+
+    if (d->mode != OMD_HOMING_MODE || HomingMethod != HM_CURRENT_THRESHOLD_NEGATIVE_SPEED)
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    d->pd = d->p;
+    d->vd = 0;
+    d->homing = 1;
+    return 1;
+}
+
+BOOL VCS_WaitForHomingAttained(HANDLE KeyHandle, WORD NodeId, DWORD Timeout, DWORD *pErrorCode)
+{
+    double end = now() + Timeout*1e-3;
+
+    while (true)
+    {
+        {
+            ACCESS(KeyHandle, NodeId, pErrorCode);
+
+            if (d->homing == 3)
+                return 1;
+
+            if (d->fault || d->homing == 0)
+            {
+                *pErrorCode = SIM_E_STATE;
+                return 0;
+            }
+        }
+
+        if (now() >= end)
+        {
+            *pErrorCode = SIM_E_TIMEOUT;
+            return 0;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+BOOL VCS_GetHomingState(HANDLE KeyHandle, WORD NodeId, BOOL *pHomingAttained, BOOL *pHomingError, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pHomingAttained = d->homing == 3;
+    *pHomingError = d->fault;
+    return 1;
+}
+
+BOOL VCS_ActivateInterpolatedPositionMode(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    return VCS_SetOperationMode(KeyHandle, NodeId, OMD_INTERPOLATED_POSITION_MODE, pErrorCode);
+}
+
+BOOL VCS_GetFreeIpmBufferSize(HANDLE KeyHandle, WORD NodeId, DWORD *pBufferSize, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pBufferSize = SIM_IPMSIZE - d->ipm.size();
+    return 1;
+}
+
+BOOL VCS_ClearIpmBuffer(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->ipm.clear();
+    d->running = false;
+    d->vd = 0;
+    d->underflow = false;
+    d->overflow = false;
+    return 1;
+}
+
+BOOL VCS_AddPvtValueToIpmBuffer(HANDLE KeyHandle, WORD NodeId, int Position, int Velocity, BYTE Time, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (d->ipm.size() >= SIM_IPMSIZE)
+    {
+        d->overflow = true;
+        *pErrorCode = SIM_E_OVERFLOW;
+        return 0;
+    }
+
+    d->ipm.push_back(pvtPoint{static_cast<double>(Position), Velocity*SIM_QPR/60.0, Time*1e-3});
+    return 1;
+}
+
+BOOL VCS_StartIpmTrajectory(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (!ready(*d, pErrorCode))
+        return 0;
+
+    if (d->mode != OMD_INTERPOLATED_POSITION_MODE)
+    {
+        *pErrorCode = SIM_E_STATE;
+        return 0;
+    }
+
+    if (!d->running)
+    {
+        d->running = true;
+        d->vd = 0;
+        trigger(*d, DR_MOVEMENT_START_TRIGGER);
+        nextSegment(*d);
+    }
+    return 1;
+}
+
+BOOL VCS_StopIpmTrajectory(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->running = false;
+    d->vd = 0;
+    return 1;
+}
+
+BOOL VCS_GetIpmStatus(HANDLE KeyHandle, WORD NodeId, BOOL *pTrajectoryRunning, BOOL *pIsUnderflowWarning, BOOL *pIsOverflowWarning, BOOL *pIsVelocityWarning, BOOL *pIsAccelerationWarning, BOOL *pIsUnderflowError, BOOL *pIsOverflowError, BOOL *pIsVelocityError, BOOL *pIsAccelerationError, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pTrajectoryRunning = d->running;
+    *pIsUnderflowWarning = d->running && d->ipm.size() < 2;
+    *pIsOverflowWarning = d->ipm.size() >= SIM_IPMSIZE - 2;
+    *pIsVelocityWarning = 0;
+    *pIsAccelerationWarning = 0;
+    *pIsUnderflowError = d->underflow;
+    *pIsOverflowError = d->overflow;
+    *pIsVelocityError = 0;
+    *pIsAccelerationError = 0;
+    return 1;
+}
+
+BOOL VCS_GetPositionIs(HANDLE KeyHandle, WORD NodeId, int *pPositionIs, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pPositionIs = static_cast<int>(std::lround(d->p));
+    return 1;
+}
+
+BOOL VCS_GetVelocityIs(HANDLE KeyHandle, WORD NodeId, int *pVelocityIs, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pVelocityIs = static_cast<int>(std::lround(d->v*60.0/SIM_QPR));
+    return 1;
+}
+
+BOOL VCS_GetCurrentIs(HANDLE KeyHandle, WORD NodeId, short *pCurrentIs, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pCurrentIs = static_cast<short>(std::lround(d->cur));
+    return 1;
+}
+
+BOOL VCS_GetMovementState(HANDLE KeyHandle, WORD NodeId, BOOL *pTargetReached, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pTargetReached = !d->running && d->homing != 1 && d->homing != 2 && std::abs(d->pd - d->p) < 10;
+    return 1;
+}
+
+BOOL VCS_SetRecorderParameter(HANDLE KeyHandle, WORD NodeId, WORD SamplingPeriod, WORD NbOfPrecedingSamples, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (SamplingPeriod == 0 || NbOfPrecedingSamples >= recSize(*d))
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    d->recPeriod = SamplingPeriod*SIM_RECBASE;
+    d->recPre = NbOfPrecedingSamples;
+    return 1;
+}
+
+BOOL VCS_EnableTrigger(HANDLE KeyHandle, WORD NodeId, BYTE TriggerType, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->triggers |= TriggerType;
+    return 1;
+}
+
+BOOL VCS_DisableAllTriggers(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->triggers = 0;
+    return 1;
+}
+
+BOOL VCS_ActivateChannel(HANDLE KeyHandle, WORD NodeId, BYTE ChannelNumber, WORD ObjectIndex, BYTE ObjectSubIndex, BYTE ObjectSize, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (ChannelNumber < 1 || ChannelNumber > SIM_RECCH || ChannelNumber > d->nchan + 1 ||
+        (ObjectSize != 1 && ObjectSize != 2 && ObjectSize != 4))
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    d->chan[ChannelNumber - 1] = recChannel{ObjectIndex, ObjectSubIndex, ObjectSize};
+    d->nchan = std::max(d->nchan, static_cast<int>(ChannelNumber));
+    d->rec.clear();
+    return 1;
+}
+
+BOOL VCS_DeactivateAllChannels(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->nchan = 0;
+    d->rec.clear();
+    return 1;
+}
+
+BOOL VCS_StartRecorder(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->rec.clear();
+    d->recRunning = d->nchan > 0;
+    d->recTriggered = false;
+    d->recNext = d->last;
+    return 1;
+}
+
+BOOL VCS_StopRecorder(HANDLE KeyHandle, WORD NodeId, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    d->recRunning = false;
+    return 1;
+}
+
+BOOL VCS_IsRecorderRunning(HANDLE KeyHandle, WORD NodeId, BOOL *pRunning, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pRunning = d->recRunning;
+    return 1;
+}
+
+BOOL VCS_IsRecorderTriggered(HANDLE KeyHandle, WORD NodeId, BOOL *pTriggered, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pTriggered = d->recTriggered;
+    return 1;
+}
+
+BOOL VCS_ReadChannelVectorSize(HANDLE KeyHandle, WORD NodeId, DWORD *pVectorSize, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    *pVectorSize = recSize(*d);
+    return 1;
+}
+
+BOOL VCS_ReadChannelDataVector(HANDLE KeyHandle, WORD NodeId, BYTE ChannelNumber, BYTE *pDataVectorBuffer, DWORD VectorBufferSize, DWORD *pErrorCode)
+{
+    ACCESS(KeyHandle, NodeId, pErrorCode);
+
+    if (ChannelNumber < 1 || ChannelNumber > d->nchan)
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    const recChannel &ch = d->chan[ChannelNumber - 1];
+    const size_t n = recSize(*d);
+
+    if (VectorBufferSize < n*ch.size)
+    {
+        *pErrorCode = SIM_E_PARAM;
+        return 0;
+    }
+
+    // Little-endian samples, unrecorded ones are zero
+    memset(pDataVectorBuffer, 0, n*ch.size);
+    for (size_t i = 0; i < d->rec.size() && i < n; i++)
+    {
+        unsigned int val = static_cast<unsigned int>(d->rec[i][ChannelNumber - 1]);
+        for (int b = 0; b < ch.size; b++)
+            pDataVectorBuffer[i*ch.size + b] = static_cast<BYTE>(val >> (8*b));
+    }
+
+    // Bulk transfer time
+    lk.unlock();
+    std::this_thread::sleep_for(std::chrono::duration<double>(n*ch.size*SIM_BYTE));
+    return 1;
+}
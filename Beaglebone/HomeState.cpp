@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "HomeState.h"
+#include "Log.h"
+
+// homeState constructor
+//   path: state file, rewritten on every change
+//   discard: ignore the stored references, forcing all drives to home
+homeState::homeState(const std::string &path, const bool discard) :
+    file(path)
+{
+    std::ifstream stateFile(file);
+
+    if (!stateFile.is_open())
+        return;
+
+    if (discard)
+    {
+        Log::print(LOG_INFO, "Ignoring homing references in %s", file.c_str());
+        return;
+    }
+
+    std::string line;
+
+    while (std::getline(stateFile, line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        int motor;
+        homeRef ref;
+
+        if (fields >> kind >> motor >> ref.token >> ref.offset >> ref.position && kind == "motor")
+            refs[motor] = ref;
+    }
+
+    Log::print(LOG_INFO, "Loaded %zu homing references from %s", refs.size(), file.c_str());
+}
+
+// Stored reference of a motor, false if there is none
+bool homeState::get(const int motor, homeRef &ref)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = refs.find(motor);
+    if (it == refs.end())
+        return false;
+
+    ref = it->second;
+    return true;
+}
+
+// Store the reference of a motor
+void homeState::set(const int motor, const homeRef &ref)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    refs[motor] = ref;
+    save();
+}
+
+// Forget the reference of a motor
+void homeState::clear(const int motor)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (refs.erase(motor))
+        save();
+}
+
+// Write all references, replacing the file only once complete
+void homeState::save()
+{
+    std::string tmp = file + ".tmp";
+    std::ofstream stateFile(tmp);
+
+    if (!stateFile.is_open())
+    {
+        Log::print(LOG_WARN, "Cannot write %s", tmp.c_str());
+        return;
+    }
+
+    for (const auto &r : refs)
+    {
+        stateFile << "motor " << r.first << " " << r.second.token << " " << r.second.offset << " "
+                  << r.second.position << std::endl;
+    }
+
+    stateFile.close();
+
+    if (!stateFile || rename(tmp.c_str(), file.c_str()) != 0)
+        Log::print(LOG_WARN, "Cannot replace %s", file.c_str());
+}
@@ -0,0 +1,38 @@
+#ifndef HOMESTATE_H
+#define HOMESTATE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <QtGlobal>
+
+// Homing reference of one drive
+struct homeRef
+{
+    quint32 token;      // Value left in a volatile drive object after homing
+    long offset;        // Homing offset used (qc)
+    long position;      // Last known position (qc)
+};
+
+// Homing references kept across restarts of the process, so that drives
+// that stayed powered do not need to search their end stop again
+//   motor <n> <token> <offset> <position>
+class homeState
+{
+private:
+    std::string file;
+    std::map<int, homeRef> refs;
+    std::mutex lock;
+
+    void save();
+
+public:
+    homeState(const std::string &path, const bool discard = false);
+
+    bool get(const int motor, homeRef &ref);
+    void set(const int motor, const homeRef &ref);
+    void clear(const int motor);
+};
+
+#endif // HOMESTATE_H
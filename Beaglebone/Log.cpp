@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+
+#include "Log.h"
+#include "Clock.h"
+
+// Initialize static variables
+Log::entry Log::ring[LOGSIZE];
+std::atomic<unsigned int> Log::head(0);
+unsigned int Log::tail = 0;
+std::atomic<unsigned long> Log::dropped(0);
+unsigned long Log::reported = 0;
+std::atomic<int> Log::threshold(LOG_INFO);
+std::atomic<bool> Log::running(false);
+std::thread Log::worker;
+
+static const char levelTag[] = {'D', 'I', 'W', 'E'};
+
+// Start the printing thread
+//   level: messages below this severity are discarded
+void Log::start(const logLevel level)
+{
+    if (running)
+        return;
+
+    for (unsigned int i = 0; i < LOGSIZE; i++)
+        ring[i].seq.store(i, std::memory_order_relaxed);
+
+    head = 0;
+    tail = 0;
+    threshold = level;
+    running = true;
+
+    worker = std::thread(&Log::loop);
+}
+
+// Print the pending entries and stop the printing thread
+void Log::stop()
+{
+    if (running)
+    {
+        running = false;
+        worker.join();
+
+        while (flush());
+
+        if (dropped > 0)
+            std::cout << dropped << " log messages dropped" << std::endl;
+    }
+}
+
+// Reserve a ring slot, null if the ring is full
+Log::entry *Log::claim()
+{
+    unsigned int pos = head.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        entry *e = &ring[pos & (LOGSIZE - 1)];
+        int diff = static_cast<int>(e->seq.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0)
+        {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                return e;
+        }
+        else if (diff < 0)
+            return nullptr;
+        else
+            pos = head.load(std::memory_order_relaxed);
+    }
+}
+
+// Append a formatted message
+void Log::print(const logLevel level, const char *fmt, ...)
+{
+    if (level < threshold)
+        return;
+
+    qint64 stamp = Clock::now();
+
+    if (!running)
+    {
+        char text[LOGTEXT];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(text, LOGTEXT, fmt, args);
+        va_end(args);
+
+        output(level, stamp, text);
+        return;
+    }
+
+    entry *e = claim();
+
+    if (!e)
+    {
+        dropped++;
+        return;
+    }
+
+    e->level = level;
+    e->stamp = stamp;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(e->text, LOGTEXT, fmt, args);
+    va_end(args);
+
+    unsigned int pos = e->seq.load(std::memory_order_relaxed);
+    e->seq.store(pos + 1, std::memory_order_release);
+}
+
+// Append a multi-line message, one entry per line
+void Log::text(const logLevel level, const std::string &s)
+{
+    size_t start = 0;
+
+    while (start < s.size())
+    {
+        size_t end = s.find('\n', start);
+        if (end == std::string::npos)
+            end = s.size();
+
+        print(level, "%.*s", static_cast<int>(end - start), s.c_str() + start);
+        start = end + 1;
+    }
+}
+
+// Write one line to the console
+void Log::output(const logLevel level, const qint64 stamp, const char *text)
+{
+    char line[LOGTEXT + 32];
+    snprintf(line, sizeof line, "[%12.6f] %c %s\n", Clock::seconds(stamp), levelTag[level], text);
+
+    std::cout << line;
+}
+
+// Print the entries published so far, returns false if there were none
+bool Log::flush()
+{
+    bool any = false;
+
+    while (true)
+    {
+        entry *e = &ring[tail & (LOGSIZE - 1)];
+
+        if (e->seq.load(std::memory_order_acquire) != tail + 1)
+            break;
+
+        output(e->level, e->stamp, e->text);
+        e->seq.store(tail + LOGSIZE, std::memory_order_release);
+        tail++;
+
+        any = true;
+    }
+
+    unsigned long d = dropped;
+    if (d > reported)
+    {
+        char text[LOGTEXT];
+        snprintf(text, LOGTEXT, "%lu log messages dropped", d - reported);
+        output(LOG_WARN, Clock::now(), text);
+        reported = d;
+    }
+
+    if (any)
+        std::cout << std::flush;
+
+    return any;
+}
+
+// Printing loop, polls the ring so that writers never need to wake it
+void Log::loop()
+{
+    while (running)
+    {
+        if (!flush())
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
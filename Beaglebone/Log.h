@@ -0,0 +1,55 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <QtGlobal>
+
+#define LOGSIZE 256     // Ring entries (power of two)
+#define LOGTEXT 120     // Characters per entry, longer messages are truncated
+
+enum logLevel {LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR};
+
+// Asynchronous logger
+// Any thread formats its message into a preallocated slot of a lock-free ring,
+// without blocking or allocating; a background thread prints the entries.
+// Messages are dropped and counted when the ring is full. Before start() and
+// after stop() messages are printed directly.
+class Log
+{
+private:
+    struct entry
+    {
+        std::atomic<unsigned int> seq;  // Slot state (bounded MPMC queue)
+        logLevel level;
+        qint64 stamp;
+        char text[LOGTEXT];
+    };
+
+    static entry ring[LOGSIZE];
+    static std::atomic<unsigned int> head;
+    static unsigned int tail;           // Consumer thread only
+    static std::atomic<unsigned long> dropped;
+    static unsigned long reported;
+    static std::atomic<int> threshold;
+    static std::atomic<bool> running;
+    static std::thread worker;
+
+    static entry *claim();
+    static void output(const logLevel level, const qint64 stamp, const char *text);
+    static bool flush();
+    static void loop();
+
+public:
+    static void start(const logLevel level = LOG_INFO);
+    static void stop();
+
+    static void print(const logLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    static void text(const logLevel level, const std::string &s);
+
+    static unsigned long lost() { return dropped; }
+};
+
+#endif // LOG_H
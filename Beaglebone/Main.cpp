@@ -1,9 +1,13 @@
 #include <signal.h>
 #include <iostream>
+#include <algorithm>
 
 #include <QCoreApplication>
 
+#include "Log.h"
+#include "ChannelBench.h"
 #include "Param.h"
+#include "Topology.h"
 #include "Orthosis.h"
 
 void SigHandler(int sig)
@@ -27,11 +31,126 @@ int main(int argc, char* argv[])
     std::unique_ptr<Orthosis> o;
 
     QStringList p;
+    bool raw = false;
+    bool recorder = false;
+    bool rehome = false;
+    rtConfig rt = {false, 80, -1, false};
+    int pvtSteps = 6;
+    int libBench = 0;
+    int parserBench = 0;
+    int chanBench = 0;
+    int frameBench = 0;
+    bool cadence = false;
+    logLevel level = LOG_INFO;
+    imuMode mode = {IMUBAUD, ALLCH, false, 0};
 
-    p.push_back("ttyO2");
-    p.push_back("ttyO4");
+    // Usage: Orthosis [--verbose] [--raw] [--imu-fast] [--imu-baud bps] [--imu-mask hex]
+    //                 [--imu-seq] [--imu-interval ms] [--recorder] [--pvt-steps n]
+    //                 [--home] [--rt] [--rt-prio p] [--rt-cpu n] [--sensor-trigger]
+    //                 [--lib-bench n] [--parser-bench n] [--channel-bench n]
+    //                 [--frame-bench n] [--cadence] [port1 port2 ...]
+    // Ports given on the command line replace those of Topology.ini in order
+    // "--home" searches the end stops even if the drives kept their reference
+    // "--rt" runs the control loop in a SCHED_FIFO thread instead of the Qt timer
+    // "--sensor-trigger" runs a control frame as soon as every AHRS has a new sample
+    // "--lib-bench" times n trajectory library lookups against generation and exits
+    // "--parser-bench" parses n frames of the --imu-* layout at several corruption rates and exits
+    // "--channel-bench" passes n samples between threads by latestSlot and by queued signal and exits
+    // "--frame-bench" times control frames over synthetic topologies of 1 to n joints and exits
+    // "--cadence" scales the cycle length with the stride period measured from heel-off
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); i++)
+    {
+        if (args[i] == QString("--verbose"))
+            level = LOG_DEBUG;
+        else if (args[i] == QString("--raw"))
+            raw = true;
+        else if (args[i] == QString("--recorder"))
+            recorder = true;
+        else if (args[i] == QString("--home"))
+            rehome = true;
+        else if (args[i] == QString("--rt"))
+            rt.enabled = true;
+        else if (args[i] == QString("--cadence"))
+            cadence = true;
+        else if (args[i] == QString("--sensor-trigger"))
+            rt.triggered = true;
+        else if (args[i] == QString("--rt-prio") && i + 1 < args.size())
+            rt.priority = std::min(99, std::max(1, args[++i].toInt()));
+        else if (args[i] == QString("--rt-cpu") && i + 1 < args.size())
+            rt.cpu = args[++i].toInt();
+        else if (args[i] == QString("--pvt-steps") && i + 1 < args.size())
+            pvtSteps = std::max(1, args[++i].toInt());
+        else if (args[i] == QString("--lib-bench") && i + 1 < args.size())
+            libBench = std::max(1, args[++i].toInt());
+        else if (args[i] == QString("--parser-bench") && i + 1 < args.size())
+            parserBench = std::max(1, args[++i].toInt());
+        else if (args[i] == QString("--channel-bench") && i + 1 < args.size())
+            chanBench = std::max(1, args[++i].toInt());
+        else if (args[i] == QString("--frame-bench") && i + 1 < args.size())
+            frameBench = std::max(1, args[++i].toInt());
+        else if (args[i] == QString("--imu-fast"))
+            mode = imuMode{230400, 0x1F, true, 10}; // Quaternion and vertical acceleration at 100 Hz
+        else if (args[i] == QString("--imu-baud") && i + 1 < args.size())
+            mode.baud = args[++i].toInt();
+        else if (args[i] == QString("--imu-mask") && i + 1 < args.size())
+            mode.mask = args[++i].toInt(nullptr, 16);
+        else if (args[i] == QString("--imu-seq"))
+            mode.seq = true;
+        else if (args[i] == QString("--imu-interval") && i + 1 < args.size())
+            mode.interval = args[++i].toInt();
+        else
+            p.push_back(args[i]);
+    }
 
-    o.reset(new Orthosis(100, p));
+    Log::start(level);
 
-    return app.exec();
+    if (libBench > 0)
+    {
+        pvtLibrary library(LIBFILE, pvtSteps, GEARRATIO, ENCQPR, MAXVEL, MAXACC);
+        library.open();
+        library.bench(libBench);
+
+        Log::stop();
+        return 0;
+    }
+
+    if (parserBench > 0)
+    {
+        razorParser::bench(parserBench, mode.mask, mode.seq);
+
+        Log::stop();
+        return 0;
+    }
+
+    if (chanBench > 0)
+    {
+        channelBench::run(chanBench);
+
+        Log::stop();
+        return 0;
+    }
+
+    if (frameBench > 0)
+    {
+        Orthosis::bench(frameBench, BENCHFRAMES);
+
+        Log::stop();
+        return 0;
+    }
+
+    Topology topo;
+    topo.load("Topology.ini");
+
+    for (int i = 0; i < p.size() && i < static_cast<int>(topo.sensors.size()); i++)
+        topo.sensors[i].port = p[i];
+
+    o.reset(new Orthosis(100, topo, raw, mode, recorder, pvtSteps, rehome, rt, cadence));
+
+    int ret = app.exec();
+
+    o.reset();
+    Log::stop();
+
+    return ret;
 }
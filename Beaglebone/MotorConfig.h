@@ -28,6 +28,18 @@
 #define HOMSPI 5000     // Speed during search for index
 #define HOMCUR 5000     // Current threshold
 #define HOMTMO 10000    // Homing timeout in ms
+#define HOMPOL 10       // Homing state polling interval in ms
+#define IPMPOL 5        // Interval of upload retries while a trajectory runs in ms
+
+#define WARMOBJ 0x2081  // Volatile object holding the homing token (home position, never stored)
+#define WARMTOL 5       // Tolerance of the end stop check on a kept home reference in deg
+#define WARMVEL 30      // Peak output speed of the return to a kept home position in deg/s
+
+#define NPARGRP 13      // Motor and regulator parameter groups checked at startup
+
+#define RECPER 10       // Minimum data recorder sampling period (multiples of 0.1 ms)
+#define RECPRE 20       // Data recorder samples kept before the trajectory start
+#define RECPOST 100     // Recording kept past the end of the trajectory (ms)
 
 
 // Right motor regulator parameters
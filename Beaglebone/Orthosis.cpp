@@ -1,33 +1,50 @@
 #include <iostream>
+#include <algorithm>
 
 #include "Orthosis.h"
-
-int motorControl::nc = 0;
+#include "Log.h"
+#include "Profile.h"
 
 // Convert quaternion to pitch angle
-inline double quat2ang(QVector<float> q)
+inline double quat2ang(const float *q)
 {
     return 180.0 / PI*asin(2.0*(q[2]*q[3] + q[0]*q[1]));
 }
 
 // Orthosis constructor
-Orthosis::Orthosis(int sr, QStringList SerialPorts):
+Orthosis::Orthosis(int sr, const Topology &topology, const bool rawSerial, const imuMode &mode, const bool recorder,
+                   const int pvtSteps, const bool rehome, const rtConfig &rtc, const bool cadence):
     sampRate(sr),
+    topo(topology),
+    plotSeq(0),
     pltPort(PPORT),
-    q1(NFLOATS),
-    q2(NFLOATS),
-    mPos(2),
-    status(0)
+    readyMotors(0),
+    status(0),
+    imu(topo.sensors.size(), imuSample()),
+    imuSeq(topo.sensors.size(), 0),
+    pitch(topo.sensors.size(), 0.0),
+    acc(topo.sensors.size(), 0.0),
+    ageSum(topo.sensors.size(), 0),
+    ageMax(topo.sensors.size(), 0),
+    ageCnt(topo.sensors.size(), 0),
+    mtr(topo.joints.size(), motorSample()),
+    mtrSeq(topo.joints.size(), 0),
+    sensorTimeout(1500000LL*(mode.interval > 0 ? mode.interval : IMUPER)),
+    rtCfg(rtc),
+    rt(rtc),
+    homes(HOMEFILE, rehome),
+    controlParam(topo.names(), pvtSteps)
 {
     // This is required for passing arguments through Qt signals and slots
     qRegisterMetaType<QVector<float>>("QVector<float>");
-    qRegisterMetaType<QVector<long>>("QVector<long>");
-    qRegisterMetaType<QVector<int>>("QVector<int>");
+    qRegisterMetaType<trajPtr>("trajPtr");
     qRegisterMetaType<std::string>("std::string");
     qRegisterMetaType<double>("double");
+    qRegisterMetaType<qint64>("qint64");
     qRegisterMetaType<long>("long");
     qRegisterMetaType<WORD>("WORD");
     qRegisterMetaType<BYTE>("BYTE");
+    qRegisterMetaType<swingTrace>("swingTrace");
 
     // Bind socket to local port, broadcast address
     socket.bind(LPORT, QAbstractSocket::ShareAddress);
@@ -38,24 +55,8 @@ Orthosis::Orthosis(int sr, QStringList SerialPorts):
     timer.setInterval(1);
     timer.setTimerType(Qt::PreciseTimer);
 
-    // Motor frame skipping
-    mskip = int(sampRate / MTRSR + 0.5);
-
-    // Initialize AHRS and move to their own threads
-    Rzr1.reset(new AHRS(SerialPorts[0], 1));
-    Rzr2.reset(new AHRS(SerialPorts[1], 2));
-    Rzr1->moveToThread(&thread1);
-    Rzr2->moveToThread(&thread2);
-
-    // Initialize motors (right is reversed)
-    Mtr1.reset(new maxonMotor(true,  5000));
-    Mtr2.reset(new maxonMotor(false, 5000));
-    Mtr1->moveToThread(&thread3);
-    Mtr2->moveToThread(&thread4);
-
-    // Initialize motor controls
-    rMotorControl.setMotor(Mtr1);
-    lMotorControl.setMotor(Mtr2);
+    // Default plot frame skipping
+    pskip = int(sampRate / PLTSR + 0.5);
 
     // Execute "readPendingDatagrams" when the UDP socket receives data
     connect(&socket, &QUdpSocket::readyRead, this, &Orthosis::readPendingDatagrams);
@@ -63,50 +64,242 @@ Orthosis::Orthosis(int sr, QStringList SerialPorts):
     // Execute "loop" whenever the base timer times out
     connect(&timer, &QTimer::timeout, this, &Orthosis::loop);
 
-    // Write parameters to control objects
-    connect(&controlParam, &Param::paramSend, &rMotorControl, &motorControl::paramGet);
-    connect(&controlParam, &Param::paramSend, &lMotorControl, &motorControl::paramGet);
-    connect(&controlParam, &Param::PVTSend, &rMotorControl, &motorControl::PVTGet);
-    connect(&controlParam, &Param::PVTSend, &lMotorControl, &motorControl::PVTGet);
-
-    // Connect Orthosis signals to AHRS slots
-    connect(this, &Orthosis::timeUpdate, &AHRS::timeUpdate);
-    connect(this, &Orthosis::razorSync, Rzr1.get(), &AHRS::sync);
-    connect(this, &Orthosis::razorSync, Rzr2.get(), &AHRS::sync);
-    connect(this, &Orthosis::razorDump, Rzr1.get(), &AHRS::dump);
-    connect(this, &Orthosis::razorDump, Rzr2.get(), &AHRS::dump);
-    connect(this, &Orthosis::razorStop, Rzr1.get(), &AHRS::stop);
-    connect(this, &Orthosis::razorStop, Rzr2.get(), &AHRS::stop);
-
-    // Connect AHRS signals to Orthosis slots
-    connect(Rzr1.get(), &AHRS::ready, this, &Orthosis::razorReady);
-    connect(Rzr2.get(), &AHRS::ready, this, &Orthosis::razorReady);
-    connect(Rzr1.get(), &AHRS::sendData, this, &Orthosis::razorGet);
-    connect(Rzr2.get(), &AHRS::sendData, this, &Orthosis::razorGet);
-
-    // Connect Orthosis signals to motor slots
-    connect(this, &Orthosis::motorHome, Mtr1.get(), &maxonMotor::home);
-    connect(this, &Orthosis::motorHome, Mtr2.get(), &maxonMotor::home);
-    connect(this, &Orthosis::motorRead, Mtr1.get(), &maxonMotor::read);
-    connect(this, &Orthosis::motorRead, Mtr2.get(), &maxonMotor::read);
-    connect(this, &Orthosis::motorDump, Mtr1.get(), &maxonMotor::dump);
-    connect(this, &Orthosis::motorDump, Mtr2.get(), &maxonMotor::dump);
-    connect(this, &Orthosis::motorStop, Mtr1.get(), &maxonMotor::stop);
-    connect(this, &Orthosis::motorStop, Mtr2.get(), &maxonMotor::stop);
-
-    // Connect motor signals to Orthosis slots
-    connect(Mtr1.get(), &maxonMotor::ready, this, &Orthosis::motorReady);
-    connect(Mtr2.get(), &maxonMotor::ready, this, &Orthosis::motorReady);
-    connect(Mtr1.get(), &maxonMotor::sendData, this, &Orthosis::motorGet);
-    connect(Mtr2.get(), &maxonMotor::sendData, this, &Orthosis::motorGet);
+    // Bring the devices up concurrently: the drives are configured from the bus
+    // thread while the AHRS wake up, all AHRS wait for their output together
+    qint64 t0 = Clock::now();
+
+    // Initialize motors on the bus scheduler, and their control objects
+    bus.reset(new eposBus());
+
+    for (unsigned int j = 0; j < topo.joints.size(); j++)
+    {
+        const jointCfg &jc = topo.joints[j];
+
+        Mtr.emplace_back(new maxonMotor(*bus, homes, jc.reverse, jc.offset, jc.gains, recorder));
+        maxonMotor *mtr = Mtr.back().get();
+        mtrSrc.push_back(&mtr->latest());
+
+        MotorControl.emplace_back(new motorControl(j + 1));
+        motorControl *ctl = MotorControl.back().get();
+        ctl->setMotor(Mtr.back());
+
+        // Write parameters to control objects
+        connect(&controlParam, &Param::paramSend, ctl, &motorControl::paramGet);
+        connect(&controlParam, &Param::PVTSend, ctl, &motorControl::PVTGet);
+
+        // Adapt the cycle length to the stride period measured by the controller
+        if (cadence)
+            connect(ctl, &motorControl::motorCadence, &controlParam, &Param::cadence);
+
+        // Connect Orthosis signals to motor slots
+        connect(this, &Orthosis::motorHome, mtr, &maxonMotor::home);
+        connect(this, &Orthosis::motorRead, mtr, &maxonMotor::read);
+        connect(this, &Orthosis::motorDump, mtr, &maxonMotor::dump);
+        connect(this, &Orthosis::motorStop, mtr, &maxonMotor::stop);
+
+        // Connect motor signals to Orthosis slots
+        connect(mtr, &maxonMotor::ready, this, &Orthosis::motorReady);
+        connect(mtr, &maxonMotor::fault, this, &Orthosis::motorFault);
+    }
+
+    qint64 t1 = Clock::now();
+
+    // Initialize AHRS, served either by a single epoll thread or by one shared thread
+    if (rawSerial)
+        poller.reset(new serialPoller());
+
+    for (unsigned int i = 0; i < topo.sensors.size(); i++)
+    {
+        Rzr.emplace_back(new AHRS(topo.sensors[i].port, i + 1, rawSerial, mode));
+        imuSrc.push_back(&Rzr.back()->latest());
+    }
+
+    qint64 deadline = Clock::now() + IMUWAKE*1000000LL;
+
+    for (auto &r : Rzr)
+    {
+        AHRS *rzr = r.get();
+        rzr->settle(deadline);
+
+        if (poller)
+            poller->add(rzr);
+        else
+            rzr->moveToThread(&sensorThread);
+
+        if (rtc.triggered)
+            rzr->notify(&sensorEvent);
+
+        // Connect Orthosis signals to AHRS slots
+        connect(this, &Orthosis::razorSync, rzr, &AHRS::sync);
+        connect(this, &Orthosis::razorDump, rzr, &AHRS::dump);
+        connect(this, &Orthosis::razorStop, rzr, &AHRS::stop);
+
+        // Connect AHRS signals to Orthosis slots
+        connect(rzr, &AHRS::ready, this, &Orthosis::razorReady);
+    }
+
+    qint64 t2 = Clock::now();
+
+    // Collect the drive setup, errors are thrown from here
+    for (auto &m : Mtr)
+        m->waitSetup();
+
+    qint64 t3 = Clock::now();
+
+    // The trajectory library loads in the background from the Param constructor
+    qint64 lib = controlParam.libraryTime();
+    std::string libTime = lib < 0 ? "still loading" : std::to_string(lib/1000000) + " ms";
+
+    Log::print(LOG_INFO, "Startup: EPOS2 gateway %lld ms, AHRS %lld ms, motor setup done after %lld ms, total %lld ms, "
+               "trajectory library %s", (t1 - t0)/1000000, (t2 - t1)/1000000, (t3 - t1)/1000000, (t3 - t0)/1000000,
+               libTime.c_str());
+
+    std::cout << topo.sensors.size() << " AHRS and " << topo.joints.size() << " joints" << std::endl;
 
     // Send control parameters to control objects
     controlParam.setup();
 
-    thread1.start();
-    thread2.start();
-    thread3.start();
-    thread4.start();
+    // Further knob changes are handled by the parameter thread
+    controlParam.moveToThread(&paramThread);
+    connect(this, &Orthosis::paramSet, &controlParam, &Param::request);
+    connect(this, &Orthosis::paramSave, &controlParam, &Param::save);
+    connect(this, &Orthosis::paramFeasible, &controlParam, &Param::feasible);
+    connect(&controlParam, &Param::paramDone, this, &Orthosis::paramAck);
+    connect(&controlParam, &Param::feasibleDone, this, &Orthosis::paramReply);
+
+    sensorThread.start();
+    paramThread.start();
+}
+
+// Orthosis constructor without devices, frames read the given samples
+// The parameters are the defaults, without settings file or trajectory library
+//   imus, mtrs: sample slots, one per sensor and one per joint of the topology
+Orthosis::Orthosis(const int sr, const Topology &topology, const int pvtSteps,
+                   const std::vector<const latestSlot<imuSample> *> &imus,
+                   const std::vector<const latestSlot<motorSample> *> &mtrs):
+    sampRate(sr),
+    topo(topology),
+    plotSeq(0),
+    pltPort(PPORT),
+    readyMotors(0),
+    status(0),
+    imu(topo.sensors.size(), imuSample()),
+    imuSeq(topo.sensors.size(), 0),
+    pitch(topo.sensors.size(), 0.0),
+    acc(topo.sensors.size(), 0.0),
+    ageSum(topo.sensors.size(), 0),
+    ageMax(topo.sensors.size(), 0),
+    ageCnt(topo.sensors.size(), 0),
+    mtr(topo.joints.size(), motorSample()),
+    mtrSeq(topo.joints.size(), 0),
+    imuSrc(imus),
+    mtrSrc(mtrs),
+    sensorTimeout(1500000LL*IMUPER),
+    rtCfg(rtConfig{false, 80, -1, false}),
+    rt(rtCfg),
+    homes(HOMEFILE, false),
+    controlParam(topo.names(), pvtSteps, false)
+{
+    for (unsigned int j = 0; j < topo.joints.size(); j++)
+    {
+        MotorControl.emplace_back(new motorControl(j + 1));
+        motorControl *ctl = MotorControl.back().get();
+
+        connect(&controlParam, &Param::paramSend, ctl, &motorControl::paramGet);
+        connect(&controlParam, &Param::PVTSend, ctl, &motorControl::PVTGet);
+    }
+
+    controlParam.setup();
+}
+
+// Run frames over synthetic topologies of 1 to "joints" joints and log the
+// frame cost for each joint count
+// Joints come in pairs of legs, each joint has its own sensor and uses the one
+// of the other leg as opposite sensor. The sensors follow a synthetic stride,
+// the legs half a stride apart, and the trajectory uploads are acknowledged
+// at once, so that the state machines swing once per stride
+//   frames: frames run per joint count
+void Orthosis::bench(const int joints, const int frames)
+{
+    for (int nj = 1; nj <= joints; nj++)
+    {
+        Topology topo;
+        topo.sensors.assign(nj + nj % 2, sensorCfg{QString(), 1});
+        topo.joints.clear();
+
+        for (int j = 0; j < nj; j++)
+            topo.joints.push_back(jointCfg{"Joint " + std::to_string(j + 1), j, j ^ 1, false, 0, 'R'});
+
+        std::vector<latestSlot<imuSample>> imus(topo.sensors.size());
+        std::vector<latestSlot<motorSample>> mtrs(nj);
+        std::vector<const latestSlot<imuSample> *> imuPtr;
+        std::vector<const latestSlot<motorSample> *> mtrPtr;
+
+        for (auto &s : imus)
+            imuPtr.push_back(&s);
+        for (auto &s : mtrs)
+            mtrPtr.push_back(&s);
+
+        Orthosis o(100, topo, 6, imuPtr, mtrPtr);
+
+        // Stand-in for the drives: uploads are acknowledged after the frame
+        // that requested them, swings are counted
+        std::vector<std::pair<WORD, int>> uploads;
+        unsigned long swings = 0;
+
+        for (auto &ctl : o.MotorControl)
+        {
+            connect(ctl.get(), &motorControl::motorLoad,
+                    [&uploads](const WORD id, const trajPtr, const int tag) { uploads.emplace_back(id, tag); });
+            connect(ctl.get(), &motorControl::motorRun, [&swings](const WORD, const swingTrace) { swings++; });
+        }
+
+        o.start();
+
+        // Frames are timed by the sample rate rather than by the clock, the
+        // state machines count static periods and swings in time
+        const qint64 start = Clock::now();
+
+        for (int f = 0; f < frames; f++)
+        {
+            qint64 now = start + f*1000000000LL/o.sampRate;
+
+            // New samples for this frame: the segment swings 20 degrees back
+            // and forth, and stands still but for a heel-off push around the
+            // largest forward angle
+            for (size_t i = 0; i < imus.size(); i++)
+            {
+                int k = (f + i % 2 * BENCHGAIT/2) % BENCHGAIT;
+                double a = 20*sin(2*PI*k/BENCHGAIT)*PI/180;
+                double push = k >= BENCHGAIT*40/100 && k < BENCHGAIT*45/100 ? -0.5 : 0.0;
+
+                imuSample s;
+                std::fill(s.q, s.q + MAXFLOATS, 0.0f);
+                s.stamp = now;
+                s.q[0] = cos(a/2);
+                s.q[1] = sin(a/2);
+                s.q[4] = push - cos(a);
+                imus[i].write(s);
+            }
+
+            for (auto &m : mtrs)
+                m.write(motorSample{now, 0});
+
+            o.frame(now, now);
+
+            for (auto &u : uploads)
+                o.MotorControl[u.first - 1]->loadedGet(u.first, u.second, true);
+            uploads.clear();
+        }
+
+        Log::print(LOG_INFO, "Frame cost for %d joints, %zu AHRS: mean %.2f us, max %.2f us, %.2f us per joint, "
+                   "%lu swings", nj, topo.sensors.size(), o.costSum/1000.0/o.cf, o.costMax/1000.0,
+                   o.costSum/1000.0/o.cf/nj, swings);
+
+        if (swings == 0)
+            Log::print(LOG_WARN, "Frame benchmark for %d joints: no swing, the state machines did not change phase",
+                       nj);
+    }
 }
 
 // Orthosis destructor
@@ -114,18 +307,20 @@ Orthosis::~Orthosis()
 {
     std::cout << "Destroying Orthosis" << std::endl;
 
-    thread1.quit();
-    thread2.quit();
-    thread3.quit();
-    thread4.quit();
+    sensorThread.quit();
 
     shutdown();
+
+    // Pending knob changes are completed, the parameter file is written afterwards
+    paramThread.quit();
+    paramThread.wait();
 }
 
 // Enable motors
 void Orthosis::enable()
 {
     readyMotors = 0;
+    homeStart = Clock::now();
 
     emit motorHome();
 }
@@ -134,12 +329,30 @@ void Orthosis::enable()
 void Orthosis::start()
 {
     memset(&out, 0, NOUT*sizeof(double));
-    cf = 0; pf = 0; mf = 0;
+    cf = 0; pf = 0;
+    mtrNext = 0;
+
+    for (unsigned int i = 0; i < imuSrc.size(); i++)
+    {
+        ageSum[i] = 0;
+        ageMax[i] = 0;
+        ageCnt[i] = 0;
+    }
+
+    costSum = 0;
+    costMax = 0;
+    lateSum = 0;
+    lateMax = 0;
+
+    Profile::reset();
+    Trace::reset();
 
     readyIMUs = 0;
 
+    // New session before any AHRS streams, so that all samples are logged in it
+    Clock::reset();
+
     emit razorSync();
-    emit timeUpdate(0.0);
 }
 
 // Stop control loop and dump sensor data to files
@@ -147,6 +360,7 @@ void Orthosis::stop()
 {
     if (timer.isActive()) {
         timer.stop();
+        rt.stop();
 
         tm *timestr;
         time_t now;
@@ -157,6 +371,36 @@ void Orthosis::stop()
 
         strftime(the_date, 50, "%Y-%m-%d-%H%M%S", timestr);
 
+        if (poller)
+            poller->stop();
+
+        for (unsigned int i = 0; i < imuSrc.size(); i++)
+        {
+            if (ageCnt[i] > 0)
+            {
+                std::cout << "AHRS " << i + 1 << " sample age: mean "
+                          << ageSum[i] / ageCnt[i] / 1000 << " us, max "
+                          << ageMax[i] / 1000 << " us" << std::endl;
+            }
+        }
+
+        if (cf > 0)
+        {
+            std::cout << "Loop cost for " << MotorControl.size() << " joints: mean "
+                      << costSum / static_cast<qint64>(cf) / 1000.0 << " us, max "
+                      << costMax / 1000.0 << " us" << std::endl;
+
+            Log::print(LOG_INFO, "Frame start after schedule (%s): mean %lld us, max %lld us",
+                       rtCfg.triggered ? "sensor trigger" : rtCfg.enabled ? "real-time thread" : "Qt timer",
+                       lateSum/static_cast<qint64>(cf)/1000, lateMax/1000);
+        }
+
+        rt.report();
+        bus->report();
+        Profile::report();
+        Trace::report();
+        Profile::dump("log/" + std::string(the_date));
+
         emit razorStop();
         emit razorDump("log/" + std::string(the_date));
         emit motorDump("log/" + std::string(the_date));
@@ -168,80 +412,211 @@ void Orthosis::shutdown()
 {
     stop();
     emit motorStop();
-    rMotorControl.reset();
-    lMotorControl.reset();
+
+    for (auto &ctl : MotorControl)
+        ctl->reset();
 }
 
-// Control loop
+// Control loop driven by the 1 ms Qt timer, which only sends plot frames
+// when a thread of its own runs the control frames
 void Orthosis::loop()
 {
-    // Update current frame (in base timer resolution)
-    if (etimer.elapsed() >= 1000.0 * cf / sampRate)
+    if (rtCfg.enabled || rtCfg.triggered)
     {
-        // Current time in seconds
-        t = static_cast<double>(cf++) / sampRate;
-        emit timeUpdate(t);
-
-        // Get current thigh angles and accelerations
-        rPitch = quat2ang(q1);
-        lPitch =-quat2ang(q2);
-        rAcc = q1[4] + cos(rPitch * PI/180);
-        lAcc = q2[4] + cos(lPitch * PI/180);
-
-        // Send motors to corresponding positions
-        rMotorControl(rPitch, lPitch, rAcc);
-        lMotorControl(lPitch, rPitch, lAcc);
-
-        // Store output values
-        out[0] = t;
-        out[1] = rPitch + 35.0;
-        out[2] = lPitch + 35.0;
-        out[3] = mPos[0];
-        out[4] = mPos[1];
-        out[5] = 0;
-        out[6] = 10*rAcc + 35.0;
-        out[7] = 10*lAcc + 35.0;
+        sendPlot();
+        return;
     }
 
+    qint64 now = Clock::now();
+    qint64 due = loopStart + static_cast<qint64>(cf) * 1000000000 / sampRate;
+
+    // Update current frame (in base timer resolution)
+    if (now >= due)
+        frame(now, due);
+
     if (cf >= pf) {
-        socket.writeDatagram(QByteArray((const char *)out, NOUT*sizeof(double)), UDPClient, pltPort);
+        sendPlot();
         pf += pskip;
     }
 
-    if (cf >= mf) {
-        emit motorRead(t);
-        mf += mskip;
+    if (now >= mtrNext) {
+        emit motorRead();
+        mtrNext = now + static_cast<qint64>(1e9/MTRSR);
     }
 }
 
-// An AHRS is synchronized
-void Orthosis::razorReady()
+// Frame of the control thread
+//   due: scheduled or triggered frame time (monotonic ns)
+void Orthosis::rtFrame(const qint64 due)
+{
+    qint64 now = Clock::now();
+
+    frame(now, due);
+
+    // Motor reads only queue bus requests, safe from this thread
+    if (now >= mtrNext) {
+        for (auto &m : Mtr)
+            m->read();
+        mtrNext = now + static_cast<qint64>(1e9/MTRSR);
+    }
+}
+
+// Every AHRS has a sample not used by a frame yet
+//   newest: arrival time of the newest of these samples (monotonic ns)
+bool Orthosis::sensorsReady(qint64 &newest)
 {
-    if (++readyIMUs == 2)
+    newest = 0;
+
+    for (size_t i = 0; i < imuSrc.size(); i++)
     {
-        timer.start();
-        etimer.start();
+        unsigned int seq = imuSeq[i];
+        imuSample s;
+
+        if (!imuSrc[i]->read(s, seq))
+            return false;
+
+        newest = std::max(newest, s.stamp);
     }
+
+    return true;
 }
 
-// Get AHRS data
-void Orthosis::razorGet(const int id, const QVector<float> qin)
+// Control frame: read the latest samples and run the motor state machines
+//   now: frame time (monotonic ns)
+//   due: scheduled frame time
+void Orthosis::frame(const qint64 now, const qint64 due)
 {
-    if (id == 1) q1 = qin;
-    if (id == 2) q2 = qin;
+    const qint64 begin = Clock::now();
+
+    // Current frame time
+    cf++;
+    stamp = now;
+    t = Clock::seconds(stamp);
+
+    qint64 late = now - due;
+    lateSum += late;
+    if (late > lateMax)
+        lateMax = late;
+
+    const size_t ns = imuSrc.size();
+    const size_t nj = MotorControl.size();
+
+    // Get latest samples, segment angles and vertical accelerations
+    qint64 t0 = Clock::now();
+    for (size_t i = 0; i < ns; i++)
+    {
+        if (imuSrc[i]->read(imu[i], imuSeq[i]))
+        {
+            qint64 age = stamp - imu[i].stamp;
+            Profile::record(ST_AGE, age);
+
+            ageSum[i] += age;
+            ageCnt[i]++;
+            if (age > ageMax[i])
+                ageMax[i] = age;
+        }
+
+        pitch[i] = topo.sensors[i].sign*quat2ang(imu[i].q);
+        acc[i] = imu[i].q[4] + cos(pitch[i] * PI/180);
+    }
+    Profile::record(ST_ANGLE, Clock::now() - t0);
+
+    // Send motors to corresponding positions
+    for (size_t j = 0; j < nj; j++)
+    {
+        const jointCfg &jc = topo.joints[j];
+
+        mtrSrc[j]->read(mtr[j], mtrSeq[j]);
+
+        t0 = Clock::now();
+        (*MotorControl[j])(stamp, imu[jc.own].stamp, pitch[jc.own], pitch[jc.opp], acc[jc.own]);
+        Profile::record(ST_CONTROL, Clock::now() - t0);
+    }
+
+    // Store output values (first two joints)
+    memset(&out, 0, NOUT*sizeof(double));
+    out[0] = t;
+    for (size_t j = 0; j < nj && j < 2; j++)
+    {
+        const jointCfg &jc = topo.joints[j];
+
+        out[1 + j] = pitch[jc.own] + 35.0;
+        out[3 + j] = mtr[j].pos;
+        out[6 + j] = 10*acc[jc.own] + 35.0;
+    }
+
+    plotFrame frameOut;
+    memcpy(frameOut.v, out, sizeof frameOut.v);
+    plot.write(frameOut);
+
+    qint64 cost = Clock::now() - begin;
+    Profile::record(ST_FRAME, cost);
+    costSum += cost;
+    if (cost > costMax)
+        costMax = cost;
+}
+
+// Send the latest plot frame, from the Qt thread
+void Orthosis::sendPlot()
+{
+    plotFrame f;
+
+    if (plot.read(f, plotSeq))
+        socket.writeDatagram(QByteArray((const char *)f.v, NOUT*sizeof(double)), UDPClient, pltPort);
+}
+
+// An AHRS is synchronized
+void Orthosis::razorReady()
+{
+    if (++readyIMUs == Rzr.size())
+    {
+        if (poller)
+            poller->start();
+
+        loopStart = Clock::now();
+
+        if (rtCfg.triggered)
+        {
+            // Frames follow the AHRS output, Qt keeps the plot output at its own rate
+            timer.start(std::max(1, static_cast<int>(1000*pskip/sampRate)));
+            rt.start(sensorEvent, [this](qint64 &newest) { return sensorsReady(newest); }, sensorTimeout,
+                     [this](qint64 due) { rtFrame(due); });
+        }
+        else if (rtCfg.enabled)
+        {
+            // Qt keeps the plot output, at its own rate
+            timer.start(std::max(1, static_cast<int>(1000*pskip/sampRate)));
+            rt.start(loopStart, 1000000000/sampRate, [this](qint64 due) { rtFrame(due); });
+        }
+        else
+            timer.start(1);
+    }
 }
 
 // A motor is enabled and at home position
 void Orthosis::motorReady()
 {
-    if (++readyMotors == 2)
+    if (++readyMotors == Mtr.size())
+    {
         status = 1;
+
+        Log::print(LOG_INFO, "Startup: %zu motors homed in %lld ms", Mtr.size(), (Clock::now() - homeStart)/1000000);
+    }
 }
 
-// Get motor position
-void Orthosis::motorGet(const WORD id, const double mIn)
+// A drive request failed on the bus, stop the loop and disable all motors
+// The client sees status 0 on its next connection and has to switch on again
+void Orthosis::motorFault(const WORD id)
 {
-    mPos[id-1] = mIn;
+    if (status > 0)
+    {
+        Log::print(LOG_ERROR, "Motor %d fault, disabling the motors", id);
+
+        status = 0;
+        shutdown();
+    }
+    else if (readyMotors < Mtr.size())
+        Log::print(LOG_ERROR, "Startup: motor %d fault, %u of %zu motors homed", id, readyMotors, Mtr.size());
 }
 
 // UDP server command parser
@@ -257,14 +632,12 @@ void Orthosis::readPendingDatagrams()
             socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
             socket.writeDatagram(&status, sizeof(status), UDPClient, cmdPort);
 
-            double exportParam[2*NPARAM];
-            for (int i = 0; i < NPARAM; i++)
-            {
-                exportParam[i] = controlParam.get(0, i);
-                exportParam[i + NPARAM] = controlParam.get(1, i);
-            }
+            std::vector<double> exportParam(controlParam.channels()*NPARAM);
+            for (int ch = 0; ch < controlParam.channels(); ch++)
+                for (int i = 0; i < NPARAM; i++)
+                    exportParam[ch*NPARAM + i] = controlParam.get(ch, i);
 
-            QByteArray paramList((const char *)exportParam, sizeof(exportParam));
+            QByteArray paramList((const char *)exportParam.data(), exportParam.size()*sizeof(double));
             socket.writeDatagram(paramList, UDPClient, cmdPort);
 
             std::string IP = UDPClient.toString().toStdString().substr(7);
@@ -280,18 +653,10 @@ void Orthosis::readPendingDatagrams()
         }
         else if (message == QString("On"))
         {
-            try
-            {
-                if (!status)
-                {
-                    enable();
-                    socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
-                }
-            }
-            catch (const char *e)
+            if (!status)
             {
-                std::cout << "Exception in " << e << ", closing" << std::endl;
-                return;
+                enable();
+                socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
             }
         }
         else if (message == QString("Off"))
@@ -299,7 +664,7 @@ void Orthosis::readPendingDatagrams()
             if (status > 0)
             {
                 status = 0;
-                controlParam.save();
+                emit paramSave();
                 shutdown();
                 socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
             }
@@ -322,18 +687,24 @@ void Orthosis::readPendingDatagrams()
                 socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
             }
         }
+        else if (message == QString("Latency"))
+        {
+            std::string summary = Profile::summary();
+            socket.writeDatagram(QByteArray(summary.c_str(), summary.size()), UDPClient, cmdPort);
+        }
+        else if (message == QString("Limits"))
+        {
+            // Per channel: largest kr, shortest and longest cycle length (doubles)
+            paramClients.emplace_back(UDPClient, cmdPort);
+            emit paramFeasible();
+        }
         else if (message.size() == 24)
         {
             double *cmd = (double*)message.data();
 
-            if (controlParam.set((int)cmd[0], (int)cmd[1], cmd[2]))
-            {
-                socket.writeDatagram(QByteArray("Ok"), UDPClient, cmdPort);
-            }
-            else
-            {
-                socket.writeDatagram(QByteArray("Err"), UDPClient, cmdPort);
-            }
+            // Answered by "paramAck" once the curve has been generated and checked
+            paramClients.emplace_back(UDPClient, cmdPort);
+            emit paramSet((int)cmd[0], (int)cmd[1], cmd[2]);
         }
         else
         {
@@ -341,3 +712,19 @@ void Orthosis::readPendingDatagrams()
         }
     }
 }
+
+// A knob change has been applied (or rejected) by the parameter thread
+void Orthosis::paramAck(const bool ok)
+{
+    paramReply(QByteArray(ok ? "Ok" : "Err"));
+}
+
+// Answer the oldest request to the parameter thread
+void Orthosis::paramReply(const QByteArray reply)
+{
+    if (paramClients.empty())
+        return;
+
+    socket.writeDatagram(reply, paramClients.front().first, paramClients.front().second);
+    paramClients.pop_front();
+}
@@ -1,16 +1,19 @@
 #ifndef ORTHOSIS_H
 #define ORTHOSIS_H
 
+#include <deque>
+
 #include <QTimer>
 #include <QThread>
 #include <QNetworkInterface>
-#include <QElapsedTimer>
 #include <QHostAddress>
 #include <QUdpSocket>
 
 #include "AHRS.h"
 #include "Param.h"
 #include "Control.h"
+#include "Topology.h"
+#include "RtLoop.h"
 
 #define NOUT 8      // Size of output array for plotting
 
@@ -21,83 +24,151 @@
 #define PLTSR  25.0 // Plot output frequency
 #define PLTSA  25.0 // Plot output frequency (Android)
 
+#define HOMEFILE "Drives.state" // Homing references of the drives
+
+#define BENCHGAIT 100       // Frames per synthetic stride of the frame benchmark
+#define BENCHFRAMES 20000   // Frames per joint count of the frame benchmark
+
+// Plot output frame
+struct plotFrame
+{
+    double v[NOUT];
+};
+
 class Orthosis : public QObject
 {
     Q_OBJECT
 
 private:
     unsigned int sampRate;    // System sample rate
-    QStringList SerialPorts;  // Serial ports for AHRS
+    Topology topo;            // Sensors and joints
 
-    double t;                 // Time
+    double t;                 // Session time of the current frame (s)
+    qint64 stamp;             // Time of the current frame (monotonic ns)
     QTimer timer;             // Main loop timer
-    QElapsedTimer etimer;     // Elapsed timer
     QUdpSocket socket;        // UDP server socket
     QHostAddress UDPClient;   // UDP client address
     QByteArray message;       // UDP message container
     double out[NOUT];         // Plot output vector
+    latestSlot<plotFrame> plot; // Last plot frame, sent from the Qt thread
+    unsigned int plotSeq;     // Sequence of the last plot frame sent
     quint16 pltPort;          // Plot socket port
     quint16 cmdPort;          // Command socket port
-    QVector<float> q1, q2;    // AHRS output vectors
-    QVector<double> mPos;     // Motor angles
     unsigned int readyIMUs;   // Synchronized AHRS counter
     unsigned int readyMotors; // Enabled motors counter
+    qint64 homeStart;         // Time of the last enable command (monotonic ns)
 
     // System status (0: disabled; 1: enabled; 3: running)
     char status;
 
-    // Frame-counting variables (main loop, plot, motor)
-    unsigned long cf, pf, mf;
-    unsigned int pskip, mskip;
+    // Frame-counting variables (main loop, plot) and time of the next motor read (monotonic ns)
+    unsigned long cf, pf;
+    unsigned int pskip;
+    qint64 mtrNext;
+    qint64 loopStart;         // First frame, once all AHRS are synchronized (monotonic ns)
+
+    // Per-sensor state: latest samples, segment angles and vertical accelerations
+    std::vector<imuSample> imu;
+    std::vector<unsigned int> imuSeq;
+    std::vector<double> pitch, acc;
+
+    // AHRS sample age when first used by the control loop (ns)
+    std::vector<qint64> ageSum, ageMax;
+    std::vector<unsigned long> ageCnt;
+
+    // Per-joint state: latest motor samples
+    std::vector<motorSample> mtr;
+    std::vector<unsigned int> mtrSeq;
+
+    // Samples read by the frames: those of the AHRS and motors, or synthetic ones
+    std::vector<const latestSlot<imuSample> *> imuSrc;
+    std::vector<const latestSlot<motorSample> *> mtrSrc;
 
-    // Thigh angles and vertical accelerations
-    double rPitch, lPitch, rAcc, lAcc;
+    // Control loop cost and frame start latency after its schedule (ns)
+    qint64 costSum, costMax;
+    qint64 lateSum, lateMax;
 
-    // Pointers to AHRS objects
-    std::unique_ptr<AHRS> Rzr1;
-    std::unique_ptr<AHRS> Rzr2;
+    // Sensor-triggered loop: signalled by all AHRS, frame timeout when one is missing (ns)
+    frameEvent sensorEvent;
+    qint64 sensorTimeout;
 
-    // Pointers to motor objects
-    std::shared_ptr<maxonMotor> Mtr1;
-    std::shared_ptr<maxonMotor> Mtr2;
+    // Executor of the control loop in its own thread (unused with the Qt timer)
+    rtConfig rtCfg;
+    rtLoop rt;
+
+    // AHRS objects
+    std::vector<std::unique_ptr<AHRS>> Rzr;
+
+    // Raw serial backend for AHRS (null when using QSerialPort)
+    std::unique_ptr<serialPoller> poller;
+
+    // Homing references kept across restarts, used by the motors
+    homeState homes;
+
+    // EPOS2 bus scheduler, shared by all motors
+    std::unique_ptr<eposBus> bus;
+
+    // Motor objects
+    std::vector<std::shared_ptr<maxonMotor>> Mtr;
 
     // Object to store control parameters
     Param controlParam;
 
+    // Clients waiting for the parameter thread (knob changes, limits), in request order
+    std::deque<std::pair<QHostAddress, quint16>> paramClients;
+
     // Motor control objects
-    motorControl rMotorControl;
-    motorControl lMotorControl;
+    std::vector<std::unique_ptr<motorControl>> MotorControl;
+
+    // Thread shared by all AHRS (motors are served by the bus scheduler)
+    QThread sensorThread;
 
-    // Seperate threads for AHRS and motors
-    QThread thread1, thread2, thread3, thread4;
+    // Thread generating and checking trajectories and writing the parameter file
+    QThread paramThread;
+
+    Orthosis(const int sr, const Topology &topology, const int pvtSteps,
+             const std::vector<const latestSlot<imuSample> *> &imus,
+             const std::vector<const latestSlot<motorSample> *> &mtrs);
 
 public:
-    Orthosis(const int sr, const QStringList SerialPorts);
+    Orthosis(const int sr, const Topology &topology, const bool rawSerial = false,
+             const imuMode &mode = imuMode{IMUBAUD, ALLCH, false, 0}, const bool recorder = false,
+             const int pvtSteps = 6, const bool rehome = false, const rtConfig &rtc = rtConfig{false, 80, -1, false},
+             const bool cadence = false);
     ~Orthosis();
 
     void enable();
     void start();
     void stop();
     void shutdown();
+    void frame(const qint64 now, const qint64 due);
+    void rtFrame(const qint64 due);
+    bool sensorsReady(qint64 &newest);
+    void sendPlot();
+
+    static void bench(const int joints, const int frames);
 
 public slots:
     void loop();
     void razorReady();
-    void razorGet(const int id, const QVector<float> qin);
     void motorReady();
-    void motorGet(const WORD id, const double mIn);
+    void motorFault(const WORD id);
     void readPendingDatagrams();
+    void paramAck(const bool ok);
+    void paramReply(const QByteArray reply);
 
 signals:
-    void timeUpdate(const double t);
     void razorSync();
     void razorRead();
     void razorDump(const std::string pathDate);
     void razorStop();
     void motorHome();
-    void motorRead(const double t);
+    void motorRead();
     void motorDump(const std::string pathDate);
     void motorStop();
+    void paramSet(const int ch, const int knob, const double val);
+    void paramSave();
+    void paramFeasible();
 };
 
 #endif // ORTHOSIS_H
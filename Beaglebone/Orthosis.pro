@@ -10,25 +10,58 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
-SOURCES +=        \
-    Main.cpp      \
-    Orthosis.cpp  \
-    AHRS.cpp      \
-    EPOS2.cpp     \
-    Control.cpp   \
-    Param.cpp     \
-    PVT.cpp
+SOURCES +=           \
+    Main.cpp         \
+    Orthosis.cpp     \
+    AHRS.cpp         \
+    Parser.cpp       \
+    ChannelBench.cpp \
+    Serial.cpp       \
+    Clock.cpp        \
+    RtLoop.cpp       \
+    Log.cpp          \
+    Profile.cpp      \
+    Trace.cpp        \
+    Topology.cpp     \
+    HomeState.cpp    \
+    Bus.cpp          \
+    EPOS2.cpp        \
+    Control.cpp      \
+    Param.cpp        \
+    PVT.cpp          \
+    PVTLib.cpp
 
-HEADERS +=        \
-    MotorConfig.h \
-    Orthosis.h    \
-    AHRS.h        \
-    EPOS2.h       \
-    Control.h     \
-    Param.h       \
-    PVT.h
+HEADERS +=           \
+    MotorConfig.h    \
+    Orthosis.h       \
+    AHRS.h           \
+    Parser.h         \
+    ChannelBench.h   \
+    Serial.h         \
+    Clock.h          \
+    RtLoop.h         \
+    Log.h            \
+    Profile.h        \
+    Trace.h          \
+    Topology.h       \
+    HomeState.h      \
+    Bus.h            \
+    EPOS2.h          \
+    Control.h        \
+    Param.h          \
+    PVT.h            \
+    PVTLib.h
 
-LIBS += -lEposCmd
+# "qmake CONFIG+=epossim" replaces the EPOS2 library by a drive simulator
+epossim {
+    INCLUDEPATH += EposSim
+    SOURCES += EposSim/EposSim.cpp
+    HEADERS += EposSim/Definitions.h
+} else {
+    LIBS += -lEposCmd
+}
 
 target.path = /home/debian
-INSTALLS += target
+topology.files = Topology.ini
+topology.path = /home/debian
+INSTALLS += target topology
@@ -1,8 +1,10 @@
 #include <cmath>
-#include <iostream>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
 
 #include "PVT.h"
+#include "Log.h"
 
 // PVT constructor
 PVT::PVT(const int nsteps, const double ratio, const int qpr)
@@ -18,22 +20,18 @@ void PVT::set(const int nsteps, const double ratio, const int qpr)
     qpd = qpr*grt/360;
 }
 
-// Return position array
-QVector<long> PVT::getP()
+// trajectory constructor
+trajectory::trajectory(const QVector<long> &p, const QVector<long> &v, const QVector<int> &t) :
+    P(p), V(v), T(t), duration(0)
 {
-    return P;
-}
-
-// Return velocity array
-QVector<long> PVT::getV()
-{
-    return V;
+    for (int i = 0; i < T.size(); i++)
+        duration += T[i];
 }
 
-// Return time array
-QVector<int> PVT::getT()
+// Return the current arrays as an immutable trajectory
+trajPtr PVT::get() const
 {
-    return T;
+    return std::make_shared<const trajectory>(P, V, T);
 }
 
 // Generate PVT array from parameter set
@@ -43,32 +41,91 @@ QVector<int> PVT::getT()
 //   kr: maximum knee flexion angle (deg)
 void PVT::gen(double cl, const double ks, const double kw, const double kr)
 {
-    // Round interval length to nearest millisecond
-    double dt = round(cl/ns*1000)/1000;
-    cl = ns*dt;
+    std::vector<double> pos(ns), vel(ns);
+    int dt = shape(ns, cl, ks, kw, pos.data(), vel.data());
 
     P.resize(0);
     V.resize(0);
     T.resize(0);
 
     for (int i = 0; i < ns; i++)
+    {
+        P.append(round(kr*pos[i]*qpd));
+        V.append(round(kr*vel[i]*grt/6));
+        T.append(dt);
+    }
+
+    P.append(0);
+    V.append(0);
+    T.append(0);
+}
+
+// Trajectory shape for unit flexion: output angle (deg) and velocity (deg/s)
+// at the end of each interval, scaled by kr for the actual trajectory
+//   pos, vel: nsteps values each
+// Returns the interval length (ms)
+int PVT::shape(const int nsteps, double cl, const double ks, const double kw, double *pos, double *vel)
+{
+    // Round interval length to nearest millisecond
+    double dt = round(cl/nsteps*1000)/1000;
+    cl = nsteps*dt;
+
+    for (int i = 0; i < nsteps; i++)
     {
         double t = dt*(i + 1);
 
         double wt = 2*PI/cl*t;
         double ph = ks*sin(wt/2) + kw*sin(wt);
 
-        double pos = kr/2*(1 - cos(wt - ph));
-        double vel = kr*PI/cl*(sin(wt - ph)*(1 - ks/2*cos(wt/2)- kw*cos(wt)));
-
-        P.append(round(pos*qpd));
-        V.append(round(vel*grt/6));
-        T.append(round(dt*1000));
+        pos[i] = 0.5*(1 - cos(wt - ph));
+        vel[i] = PI/cl*(sin(wt - ph)*(1 - ks/2*cos(wt/2)- kw*cos(wt)));
     }
 
-    P.append(0);
-    V.append(0);
-    T.append(0);
+    return round(dt*1000);
+}
+
+// Raise mv and ma to the peak velocity and acceleration of the cubic
+// interpolated by the drive from (p0, v0) to (p1, v1) over dt (s)
+void PVT::peaks(const double p0, const double v0, const double p1, const double v1, const double dt,
+                double &mv, double &ma)
+{
+    // Polynomial coefficients
+    double a = (2*(p0 - p1) + dt*(v0 + v1))/pow(dt, 3);
+    double b = (3*(p1 - p0) - dt*(2*v0 + v1))/pow(dt, 2);
+
+    // Null acceleration point
+    double t0 = -b/(3*a);
+
+    // Update maximum velocity
+    if (abs(v1) > mv)
+        mv = abs(v1);
+    if (t0 > 0 && t0 < dt && abs(v0 + b*t0) > mv)
+        mv = abs(v0 + b*t0);
+
+    // Update maximum acceleration
+    if (abs(2*b) > ma)
+        ma = abs(2*b);
+    if (abs(2*b + 6*a*dt) > ma)
+        ma = abs(2*b + 6*a*dt);
+}
+
+// Peak velocity and acceleration of a whole trajectory starting from rest
+//   pos, vel: nsteps values each, as returned by shape
+//   dt: interval length (ms)
+void PVT::peaks(const int nsteps, const double *pos, const double *vel, const int dt, double &mv, double &ma)
+{
+    double p0 = 0.0, v0 = 0.0;
+
+    mv = 0.0;
+    ma = 0.0;
+
+    for (int i = 0; i < nsteps; i++)
+    {
+        peaks(p0, v0, pos[i], vel[i], dt/1000.0, mv, ma);
+
+        p0 = pos[i];
+        v0 = vel[i];
+    }
 }
 
 // Check curve feasibility (maxvel in rpm, maxacc in rpm/s)
@@ -90,24 +147,7 @@ bool PVT::check(const double maxvel, const double maxacc)
         double v1 = V[i]*6/grt;  // Output velocity at interval end (deg/s)
         double dt = T[i]/1000.0; // Current interval length (s)
 
-        // Polynomial coefficients
-        double a = (2*(p0 - p1) + dt*(v0 + v1))/pow(dt, 3);
-        double b = (3*(p1 - p0) - dt*(2*v0 + v1))/pow(dt, 2);
-
-        // Null acceleration point
-        double t0 = -b/(3*a);
-
-        // Update maximum velocity
-        if (abs(v1) > mv)
-            mv = abs(v1);
-        if (t0 > 0 && t0 < dt && abs(v0 + b*t0) > mv)
-            mv = abs(v0 + b*t0);
-
-        // Update maximum acceleration
-        if (abs(2*b) > ma)
-            ma = abs(2*b);
-        if (abs(2*b + 6*a*dt) > ma)
-            ma = abs(2*b + 6*a*dt);
+        peaks(p0, v0, p1, v1, dt, mv, ma);
 
         p0 = p1;
         v0 = v1;
@@ -127,7 +167,45 @@ void PVT::disp()
 {
     for (int i = 0; i < T.size(); i++)
     {
-        std::cout << std::setw(9) << P[i] << std::setw(7) << V[i];
-        std::cout << std::setw(4) << T[i] << std::endl;
+        Log::print(LOG_DEBUG, "%9ld%7ld%4d", P[i], V[i], T[i]);
     }
 }
+
+// Feasible flexion and cycle length of a curve, in closed form (maxvel in rpm,
+// maxacc in rpm/s)
+// The points sit at fixed fractions of the cycle, so the peak velocity scales
+// with kr/cl and the peak acceleration with kr/cl^2; both bounds follow from
+// one evaluation of the shape. They hold up to the rounding of P and V.
+pvtLimits PVT::limits(const double cl, const double ks, const double kw, const double kr,
+                      const double maxvel, const double maxacc) const
+{
+    pvtLimits lim;
+    lim.clMax = 0.255*ns;
+
+    // The shape constants do not depend on the cycle length, use a valid one
+    std::vector<double> pos(ns), vel(ns);
+    int dt = shape(ns, std::min(std::max(cl, 0.001*ns), lim.clMax), ks, kw, pos.data(), vel.data());
+    double ce = ns*dt/1000.0;
+
+    double pv, pa;
+    peaks(ns, pos.data(), vel.data(), dt, pv, pa);
+
+    // Motor velocity (rpm*s) and acceleration (rpm*s) per degree of flexion for a 1 s cycle
+    double kv = pv*grt/6*ce;
+    double ka = pa*grt/6*ce*ce;
+
+    // Largest flexion at the cycle length actually used
+    int dtIn = round(cl/ns*1000);
+    double cin = ns*dtIn/1000.0;
+
+    if (dtIn <= 0 || dtIn > 255)
+        lim.krMax = 0;
+    else
+        lim.krMax = std::min(kv > 0 ? maxvel*cin/kv : HUGE_VAL, ka > 0 ? maxacc*cin*cin/ka : HUGE_VAL);
+
+    // Shortest cycle at this flexion, rounded up to whole milliseconds per interval
+    double c = std::max(std::abs(kr)*kv/maxvel, sqrt(std::abs(kr)*ka/maxacc));
+    lim.clMin = std::max(ceil(c/ns*1000 - 1e-9), 1.0)*ns/1000;
+
+    return lim;
+}
@@ -1,11 +1,35 @@
 #ifndef PVT_H
 #define PVT_H
 
+#include <memory>
+
 #include <QObject>
 #include <QVector>
 
 #define PI 3.14159265358979323846
 
+// Generated PVT trajectory, shared read-only by the generator, the controller
+// and the drive once published
+struct trajectory
+{
+    QVector<long> P;     // Position vector (qc)
+    QVector<long> V;     // Velocity vector (rpm)
+    QVector<int> T;      // Time intervals vector (ms)
+    qint64 duration;     // Sum of the time intervals (ms)
+
+    trajectory(const QVector<long> &p, const QVector<long> &v, const QVector<int> &t);
+};
+
+typedef std::shared_ptr<const trajectory> trajPtr;
+
+// Bounds of a trajectory shape within the drive limits
+struct pvtLimits
+{
+    double krMax;        // Largest feasible flexion at the given cycle length (deg, 0: none)
+    double clMin;        // Shortest feasible cycle length at the given flexion (s)
+    double clMax;        // Longest cycle length the drive accepts (s)
+};
+
 class PVT
 {
 private:
@@ -25,12 +49,18 @@ public:
 
     void set(const int nsteps, const double ratio, const int qpr);
 
-    QVector<long> getP();
-    QVector<long> getV();
-    QVector<int> getT();
+    int steps() const { return ns; }
+    trajPtr get() const;
+
+    static int shape(const int nsteps, double cl, const double ks, const double kw, double *pos, double *vel);
+    static void peaks(const double p0, const double v0, const double p1, const double v1, const double dt,
+                      double &mv, double &ma);
+    static void peaks(const int nsteps, const double *pos, const double *vel, const int dt, double &mv, double &ma);
 
     void gen(double cl, const double ks, const double kw, const double kr);
     bool check(const double maxvel = 12500, const double maxacc = 1e6);
+    pvtLimits limits(const double cl, const double ks, const double kw, const double kr,
+                     const double maxvel = 12500, const double maxacc = 1e6) const;
     void disp();
 };
 
@@ -0,0 +1,340 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "PVTLib.h"
+#include "Clock.h"
+#include "Log.h"
+
+// pvtLibrary constructor
+//   path: library file, rebuilt when missing or made for other settings
+//   nsteps, ratio, qpr: as for PVT
+//   maxvel, maxacc: drive limits of PVT::check (rpm, rpm/s)
+pvtLibrary::pvtLibrary(const std::string &path, const int nsteps, const double ratio, const int qpr,
+                       const double maxvel, const double maxacc) :
+    file(path), stride(2*nsteps + 2), ready(false), cancel(false), openTime(0)
+{
+    hdr.magic = LIBMAGIC;
+    hdr.version = LIBVER;
+    hdr.nsteps = nsteps;
+    hdr.ratio = ratio;
+    hdr.qpd = qpr*ratio/360;
+    hdr.maxvel = maxvel;
+    hdr.maxacc = maxacc;
+    hdr.kMin = LIBKMIN;
+    hdr.kStep = LIBKSTEP;
+    hdr.kN = LIBKN;
+}
+
+// pvtLibrary destructor
+pvtLibrary::~pvtLibrary()
+{
+    cancel = true;
+    wait();
+}
+
+// Load the library file, or build it if it does not match, in a background
+// thread below the priority of the control and bus threads
+// Lookups miss until the library is available
+void pvtLibrary::open()
+{
+    qint64 t0 = Clock::now();
+
+    builder = std::thread([this, t0]()
+    {
+        background();
+
+        if (!load())
+        {
+            size_t size = static_cast<size_t>(hdr.kN)*hdr.kN*stride*sizeof(float);
+
+            if (size > LIBMAXMB*1024*1024LL)
+            {
+                Log::print(LOG_WARN, "Trajectory library for %d steps would take %zu MB, not built", hdr.nsteps,
+                           size/1024/1024);
+                return;
+            }
+
+            cells.assign(size/sizeof(float), 0);
+
+            build();
+
+            if (cancel)
+                return;
+
+            save();
+        }
+
+        openTime = Clock::now() - t0;
+        ready = true;
+    });
+}
+
+// Run the calling thread, and the workers it starts, only when the CPU is
+// otherwise idle, or at the lowest nice level (per thread on Linux) if
+// SCHED_IDLE is refused
+void pvtLibrary::background()
+{
+    sched_param sp;
+    sp.sched_priority = 0;
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+
+    if (err != 0 && setpriority(PRIO_PROCESS, 0, 19) != 0)
+        Log::print(LOG_WARN, "Trajectory library: cannot lower the priority (%s)", strerror(err));
+}
+
+// Wait for a background build to finish
+void pvtLibrary::wait()
+{
+    if (builder.joinable())
+        builder.join();
+}
+
+// Read the cells if the file was made for the same settings
+bool pvtLibrary::load()
+{
+    std::ifstream libFile(file, std::ios::binary);
+
+    if (!libFile.is_open())
+        return false;
+
+    libHeader h;
+    libFile.read(reinterpret_cast<char *>(&h), sizeof h);
+
+    if (!libFile || h.magic != hdr.magic || h.version != hdr.version || h.nsteps != hdr.nsteps ||
+        h.ratio != hdr.ratio || h.qpd != hdr.qpd || h.maxvel != hdr.maxvel || h.maxacc != hdr.maxacc ||
+        h.kMin != hdr.kMin || h.kStep != hdr.kStep || h.kN != hdr.kN)
+    {
+        Log::print(LOG_INFO, "Trajectory library %s does not match the settings", file.c_str());
+        return false;
+    }
+
+    std::vector<float> grid(static_cast<size_t>(hdr.kN)*hdr.kN*stride);
+    libFile.read(reinterpret_cast<char *>(grid.data()), grid.size()*sizeof(float));
+
+    if (!libFile)
+    {
+        Log::print(LOG_WARN, "Trajectory library %s is truncated", file.c_str());
+        return false;
+    }
+
+    cells.swap(grid);
+
+    Log::print(LOG_INFO, "Loaded %zu trajectories from %s", cells.size()/stride, file.c_str());
+
+    return true;
+}
+
+// Write the header and the cells, replacing the file only once complete
+bool pvtLibrary::save()
+{
+    std::string tmp = file + ".tmp";
+    std::ofstream libFile(tmp, std::ios::binary);
+
+    if (!libFile.is_open())
+    {
+        Log::print(LOG_WARN, "Cannot write %s", tmp.c_str());
+        return false;
+    }
+
+    libFile.write(reinterpret_cast<const char *>(&hdr), sizeof hdr);
+    libFile.write(reinterpret_cast<const char *>(cells.data()), cells.size()*sizeof(float));
+    libFile.close();
+
+    if (!libFile || rename(tmp.c_str(), file.c_str()) != 0)
+    {
+        Log::print(LOG_WARN, "Cannot replace %s", file.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Generate the unit trajectory of every cell, spreading the peak
+// displacements over all cores
+void pvtLibrary::build()
+{
+    int nw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+
+    qint64 t0 = Clock::now();
+
+    for (int w = 0; w < nw; w++)
+        workers.emplace_back(&pvtLibrary::buildRows, this, w, nw);
+
+    for (auto &w : workers)
+        w.join();
+
+    if (!cancel)
+    {
+        Log::print(LOG_INFO, "Built trajectory library of %zu trajectories in %lld ms (%d threads)",
+                   cells.size()/stride, (Clock::now() - t0)/1000000, nw);
+    }
+}
+
+// Fill the cells of every peak displacement node from "first" on, in steps of "every"
+void pvtLibrary::buildRows(const int first, const int every)
+{
+    const int ns = hdr.nsteps;
+    std::vector<double> pos(ns), vel(ns);
+
+    for (int a = first; a < hdr.kN && !cancel; a += every)
+    {
+        for (int b = 0; b < hdr.kN; b++)
+        {
+            float *cell = &cells[(static_cast<size_t>(a)*hdr.kN + b)*stride];
+
+            // Intervals of 100 ms, the cycle length they round to is scaled out
+            int dt = PVT::shape(ns, ns*0.1, hdr.kMin + a*hdr.kStep, hdr.kMin + b*hdr.kStep, pos.data(), vel.data());
+            double cl = ns*dt/1000.0;
+
+            double mv, ma;
+            PVT::peaks(ns, pos.data(), vel.data(), dt, mv, ma);
+
+            for (int i = 0; i < ns; i++)
+            {
+                cell[i] = pos[i];
+                cell[ns + i] = vel[i]*cl;
+            }
+
+            // Peak motor velocity (rpm) and acceleration (rpm/s) per degree of flexion, for a 1 s cycle
+            cell[2*ns] = mv*cl*hdr.ratio/6;
+            cell[2*ns + 1] = ma*cl*cl*hdr.ratio/6;
+        }
+    }
+}
+
+// Grid node of a parameter value, false if the value is not on the grid
+bool pvtLibrary::node(const double val, const double min, const double step, const int n, int &i) const
+{
+    double x = (val - min)/step;
+    i = static_cast<int>(lround(x));
+
+    return i >= 0 && i < n && std::abs(x - i) <= LIBTOL;
+}
+
+// Trajectory of a parameter set
+//   cl, ks, kw, kr: as for PVT::gen
+//   traj: set when the trajectory is feasible
+// Returns LIB_MISS when the library is not available, the cycle length is
+// out of range or the shape is off the grid
+pvtLibrary::result pvtLibrary::lookup(const double cl, const double ks, const double kw, const double kr,
+                                      trajPtr &traj) const
+{
+    int a, b;
+
+    if (!ready || cl < LIBCLMIN || cl > LIBCLMAX || !node(ks, hdr.kMin, hdr.kStep, hdr.kN, a) ||
+        !node(kw, hdr.kMin, hdr.kStep, hdr.kN, b))
+        return LIB_MISS;
+
+    const int ns = hdr.nsteps;
+    const float *cell = &cells[(static_cast<size_t>(a)*hdr.kN + b)*stride];
+
+    // Interval length must be between 1 and 255 ms, the cycle length is rounded to it as by PVT::shape
+    int dt = static_cast<int>(round(cl/ns*1000));
+
+    if (dt <= 0 || dt > 255)
+        return LIB_UNFEASIBLE;
+
+    double len = ns*dt/1000.0;
+
+    if (std::abs(kr)*cell[2*ns]/len > hdr.maxvel || std::abs(kr)*cell[2*ns + 1]/(len*len) > hdr.maxacc)
+        return LIB_UNFEASIBLE;
+
+    QVector<long> P(ns + 1, 0), V(ns + 1, 0);
+    QVector<int> T(ns + 1, 0);
+
+    for (int i = 0; i < ns; i++)
+    {
+        P[i] = lround(kr*cell[i]*hdr.qpd);
+        V[i] = lround(kr*cell[ns + i]/len*hdr.ratio/6);
+        T[i] = dt;
+    }
+
+    traj = std::make_shared<const trajectory>(P, V, T);
+
+    return LIB_FEASIBLE;
+}
+
+// Compare lookups with generation and check of the same random parameter
+// sets, shapes on the grid and cycle lengths in range, and log the time per
+// trajectory
+void pvtLibrary::bench(const int n)
+{
+    wait();
+
+    if (!ready)
+    {
+        Log::print(LOG_WARN, "Trajectory library not available");
+        return;
+    }
+
+    struct parSet {double cl, ks, kw, kr;};
+    std::vector<parSet> sets(n);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> clRange(LIBCLMIN, LIBCLMAX);
+    std::uniform_int_distribution<int> kNode(0, hdr.kN - 1), krNode(0, 100);
+
+    for (auto &s : sets)
+        s = parSet{clRange(rng), hdr.kMin + kNode(rng)*hdr.kStep, hdr.kMin + kNode(rng)*hdr.kStep,
+                   static_cast<double>(krNode(rng))};
+
+    std::vector<trajPtr> found(n);
+    std::vector<result> res(n);
+
+    qint64 t0 = Clock::now();
+    for (int i = 0; i < n; i++)
+        res[i] = lookup(sets[i].cl, sets[i].ks, sets[i].kw, sets[i].kr, found[i]);
+    qint64 tLookup = Clock::now() - t0;
+
+    PVT curve(hdr.nsteps, hdr.ratio, static_cast<int>(round(hdr.qpd*360/hdr.ratio)));
+    std::vector<trajPtr> generated(n);
+    std::vector<bool> feasible(n);
+
+    t0 = Clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        curve.gen(sets[i].cl, sets[i].ks, sets[i].kw, sets[i].kr);
+        feasible[i] = curve.check(hdr.maxvel, hdr.maxacc);
+        if (feasible[i])
+            generated[i] = curve.get();
+    }
+    qint64 tGen = Clock::now() - t0;
+
+    // Differences between both ways
+    int differ = 0;
+    long dp = 0, dv = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if ((res[i] == LIB_FEASIBLE) != feasible[i])
+        {
+            differ++;
+            continue;
+        }
+
+        if (!feasible[i])
+            continue;
+
+        for (int k = 0; k < found[i]->P.size(); k++)
+        {
+            dp = std::max(dp, std::abs(found[i]->P[k] - generated[i]->P[k]));
+            dv = std::max(dv, std::abs(found[i]->V[k] - generated[i]->V[k]));
+        }
+    }
+
+    Log::print(LOG_INFO, "Trajectory library: lookup %.2f us, generation and check %.2f us per trajectory (%d sets)",
+               tLookup/1000.0/n, tGen/1000.0/n, n);
+    Log::print(LOG_INFO, "Trajectory library: %d feasibility decisions differ, largest difference %ld qc, %ld rpm",
+               differ, dp, dv);
+}
@@ -0,0 +1,79 @@
+#ifndef PVTLIB_H
+#define PVTLIB_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <QtGlobal>
+
+#include "PVT.h"
+
+#define LIBFILE "Trajectory.lib"    // Trajectory library, next to Control.ini
+#define LIBMAGIC 0x4C545650         // "PVTL"
+#define LIBVER 2
+
+#define LIBCLMIN 0.40       // Shortest cycle length looked up (s)
+#define LIBCLMAX 1.60       // Longest cycle length looked up (s)
+#define LIBKMIN -1.0        // Peak displacement and width grids: first node
+#define LIBKSTEP 0.02       // Peak displacement and width grids: spacing
+#define LIBKN 101           // Peak displacement and width grids: nodes
+#define LIBTOL 1e-3         // Largest distance to a node, in grid spacings
+#define LIBMAXMB 64         // Largest library kept in memory (MB)
+
+// Layout of the library file, followed by the cells
+struct libHeader
+{
+    quint32 magic, version;
+    qint32 nsteps;
+    double ratio, qpd, maxvel, maxacc;
+    double kMin, kStep;
+    qint32 kN;
+};
+
+// Trajectories precomputed over a grid of peak displacement and peak width,
+// for unit flexion and cycle length, built on all cores
+// The flexion amplitude scales positions, velocities and accelerations
+// linearly; positions do not depend on the cycle length, velocities scale
+// with its inverse and accelerations with its inverse square. Each cell holds
+// the positions, the velocities and the peak velocity and acceleration for
+// unit flexion and cycle length, and a lookup of any cycle length in range
+// is a scaling of one cell. Shapes off the grid are not found and must be
+// generated.
+class pvtLibrary
+{
+private:
+    std::string file;
+    libHeader hdr;
+    int stride;                 // Floats per cell: positions, velocities, peak velocity and acceleration
+    std::vector<float> cells;
+
+    std::thread builder;
+    std::atomic<bool> ready, cancel;
+    std::atomic<qint64> openTime;   // Time taken to load or build (ns)
+
+    void background();
+    bool load();
+    bool save();
+    void build();
+    void buildRows(const int first, const int every);
+    bool node(const double val, const double min, const double step, const int n, int &i) const;
+
+public:
+    enum result {LIB_MISS, LIB_FEASIBLE, LIB_UNFEASIBLE};
+
+    pvtLibrary(const std::string &path, const int nsteps, const double ratio, const int qpr,
+               const double maxvel, const double maxacc);
+    ~pvtLibrary();
+
+    void open();
+    void wait();
+    bool available() const { return ready; }
+    qint64 loadTime() const { return ready ? openTime.load() : -1; }
+
+    result lookup(const double cl, const double ks, const double kw, const double kr, trajPtr &traj) const;
+    void bench(const int n);
+};
+
+#endif // PVTLIB_H
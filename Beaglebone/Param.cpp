@@ -1,15 +1,50 @@
-#include <iostream>
+#include <cmath>
+#include <algorithm>
 #include <iomanip>
+#include <sstream>
 
 #include "Param.h"
+#include "Log.h"
+
+// Default parameter set of each channel
+static const double defPar[NPARAM] =
+{
+    40.0, // kr: maximum knee flexion (degrees)
+    0.16, // ks: peak displacement parameter (non-dimensional)
+    -0.1, // kw: peak width parameter (non-dimensional)
+    0.70, // cl: cycle length (s)
+    0.00, // it: delay from heel-off to cycle (seconds)
+    0.05, // st: acceleration threshold to consider static frame (g)
+    0.25, // mt: negative acceleration threshold to start cycle (g)
+      25, // nf: minimum static time to start cycle (10 ms frames)
+    10.0, // tw: own ankle threshold for stance (degrees)
+     4.0  // tp: opposite ankle threshold for stance (degrees)
+};
 
 // Param constructor
-Param::Param() : cCurve(2), cPar(2)
+//   nsteps: PVT intervals per trajectory (more than fit in the IPM buffer are streamed)
+//   stored: read and write the settings file and use the trajectory library
+Param::Param(const std::vector<std::string> &chNames, const int nsteps, const bool stored) :
+    nch(chNames.size()),
+    names(chNames),
+    cCurve(nch),
+    library(LIBFILE, nsteps, GEARRATIO, ENCQPR, MAXVEL, MAXACC),
+    stored(stored),
+    cPar(nch),
+    strideRef(nch, 0.0),
+    clUsed(nch, 0.0)
 {
-    RL[0] = 'R';
-    RL[1] = 'L';
-    cCurve[0].reset(new PVT(6, 160, 4096)); // R PVT array
-    cCurve[1].reset(new PVT(6, 160, 4096)); // L PVT array
+    for (int ch = 0; ch < nch; ch++)
+    {
+        cCurve[ch].reset(new PVT(nsteps, GEARRATIO, ENCQPR));
+
+        for (int i = 0; i < NPARAM; i++)
+            cPar[ch].append(defPar[i]);
+    }
+
+    // Load (or build) the trajectory library while the devices start up
+    if (stored)
+        library.open();
 }
 
 // Param destructor
@@ -18,21 +53,24 @@ Param::~Param()
     save();
 }
 
-// Load settings from file
+// Load settings from file, one line per parameter and one column per channel
+// Channels missing from the file keep their default values
 bool Param::load()
 {
     paramFile.open("Control.ini", std::fstream::in);
 
     if (paramFile.is_open())
     {
-        std::cout << "Loading configuration file" << std::endl;
-        double rval, lval;
+        Log::print(LOG_INFO, "Loading configuration file");
+        std::string line;
 
-        for (int i = 0; i < NPARAM; i++)
+        for (int i = 0; i < NPARAM && std::getline(paramFile, line); i++)
         {
-            paramFile >> rval >> lval;
-            cPar[0].append(rval);
-            cPar[1].append(lval);
+            std::istringstream values(line);
+            double val;
+
+            for (int ch = 0; ch < nch && values >> val; ch++)
+                cPar[ch][i] = val;
         }
 
         paramFile.close();
@@ -46,17 +84,21 @@ bool Param::load()
 // Write settings to file
 bool Param::save()
 {
+    if (!stored)
+        return false;
+
     paramFile.open("Control.ini", std::fstream::out);
 
     if (paramFile.is_open())
     {
-        std::cout << "Writing configuration file" << std::endl;
+        Log::print(LOG_INFO, "Writing configuration file");
         paramFile << std::setprecision(3) << std::fixed;
 
         for (int i = 0; i < NPARAM; i++)
         {
-            paramFile << std::setw(9) << cPar[0][i];
-            paramFile << std::setw(9) << cPar[1][i];
+            for (int ch = 0; ch < nch; ch++)
+                paramFile << std::setw(9) << cPar[ch][i];
+
             paramFile << std::endl;
         }
 
@@ -71,27 +113,16 @@ bool Param::save()
 // Initialize parameters storage object
 void Param::setup()
 {
-    // Load settings file
-    bool fileFound = load();
+    // Load settings file, benchmarks run on the defaults
+    if (stored)
+        load();
 
-    for (int i = 0; i < 2; i++)
+    for (int i = 0; i < nch; i++)
     {
-        if (fileFound == false) {
-            cPar[i].append(40.0); // kr: maximum knee flexion (degrees)
-            cPar[i].append(0.16); // ks: peak displacement parameter (non-dimensional)
-            cPar[i].append(-0.1); // kw: peak width parameter (non-dimensional)
-            cPar[i].append(0.70); // cl: cycle length (s)
-            cPar[i].append(0.00); // it: delay from heel-off to cycle (seconds)
-            cPar[i].append(0.05); // st: acceleration threshold to consider static frame (g)
-            cPar[i].append(0.25); // mt: negative acceleration threshold to start cycle (g)
-            cPar[i].append(  25); // nf: minimum static frames to start cycle
-            cPar[i].append(10.0); // tw: own ankle threshold for stance (degrees)
-            cPar[i].append( 4.0); // tp: opposite ankle threshold for stance (degrees)
-        }
-
+        clUsed[i] = cPar[i][3];
         cCurve[i]->gen(cPar[i][3], cPar[i][1], cPar[i][2], cPar[i][0]);
 
-        emit PVTSend(i, cCurve[i]->getP(), cCurve[i]->getV(), cCurve[i]->getT());
+        emit PVTSend(i, cCurve[i]->get());
 
         for (int par = 0; par < cPar[i].size(); par++)
             emit paramSend(i, par, cPar[i][par]);
@@ -101,34 +132,67 @@ void Param::setup()
 // Get parameters from remote interface
 double Param::get(const int ch, const int knob)
 {
+    std::lock_guard<std::mutex> guard(lock);
+
     return cPar[ch][knob];
 }
 
 // Set parameters and send to control objects
 bool Param::set(const int ch, const int knob, const double val)
 {
-    cPar[ch][knob] = val;
+    if (ch < 0 || ch >= nch || knob < 0 || knob >= NPARAM)
+    {
+        Log::print(LOG_WARN, "Unknown knob %d of channel %d", knob + 1, ch);
 
-    std::cout << "Setting knob " << knob + 1 << " of "
-              << RL[ch] << " channel to " << val << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cPar[ch][knob] = val;
+    }
+
+    Log::print(LOG_INFO, "Setting knob %d of %s channel to %g", knob + 1, names[ch].c_str(), val);
 
     emit paramSend(ch, knob, val);
 
     // Knobs 0-3 control PVT curve, feasibility must be checked before setting PVT array
     if (knob < 4)
     {
+        trajPtr traj;
+
+        // The knob sets the cycle length for the current cadence
+        strideRef[ch] = 0;
+        clUsed[ch] = cPar[ch][3];
+
+        switch (library.lookup(cPar[ch][3], cPar[ch][1], cPar[ch][2], cPar[ch][0], traj))
+        {
+        case pvtLibrary::LIB_FEASIBLE:
+            Log::print(LOG_INFO, "Using library PVT array for motor %d", ch + 1);
+            emit PVTSend(ch, traj);
+            return true;
+
+        case pvtLibrary::LIB_UNFEASIBLE:
+            unfeasible(ch);
+            return false;
+
+        case pvtLibrary::LIB_MISS:
+            break;
+        }
+
+        // Off the library grid, or the library is not ready yet
         cCurve[ch]->gen(cPar[ch][3], cPar[ch][1], cPar[ch][2], cPar[ch][0]);
 
         if (cCurve[ch]->check(MAXVEL, MAXACC))
         {
-            std::cout << "  Generating PVT array for motor " << ch + 1 << ":" << std::endl;
+            Log::print(LOG_INFO, "Generating PVT array for motor %d", ch + 1);
 
             cCurve[ch]->disp();
-            emit PVTSend(ch, cCurve[ch]->getP(), cCurve[ch]->getV(), cCurve[ch]->getT());
+            emit PVTSend(ch, cCurve[ch]->get());
         }
         else
         {
-            std::cout << "Unfeasible PVT array for motor " << ch + 1 << std::endl;
+            unfeasible(ch);
 
             return false;
         }
@@ -136,3 +200,95 @@ bool Param::set(const int ch, const int knob, const double val)
 
     return true;
 }
+
+// Closed-form bounds of the curve of a channel at its current parameters
+pvtLimits Param::limits(const int ch)
+{
+    return cCurve[ch]->limits(cPar[ch][3], cPar[ch][1], cPar[ch][2], cPar[ch][0], MAXVEL, MAXACC);
+}
+
+// Report an unfeasible curve with the values that would make it feasible
+void Param::unfeasible(const int ch)
+{
+    pvtLimits lim = limits(ch);
+
+    Log::print(LOG_WARN, "Unfeasible PVT array for motor %d: kr up to %.1f deg, cycle from %.3f to %.3f s",
+               ch + 1, lim.krMax, lim.clMin, lim.clMax);
+}
+
+// Set a parameter requested by the remote interface and report the result
+void Param::request(const int ch, const int knob, const double val)
+{
+    emit paramDone(set(ch, knob, val));
+}
+
+// Bounds of all channels requested by the remote interface: largest kr at the
+// current cycle length, shortest and longest cycle length at the current kr
+void Param::feasible()
+{
+    std::vector<double> bounds;
+
+    for (int ch = 0; ch < nch; ch++)
+    {
+        pvtLimits lim = limits(ch);
+
+        bounds.push_back(lim.krMax);
+        bounds.push_back(lim.clMin);
+        bounds.push_back(lim.clMax);
+    }
+
+    emit feasibleDone(QByteArray((const char *)bounds.data(), bounds.size()*sizeof(double)));
+}
+
+// Scale the cycle length of a channel with the stride period measured by its
+// controller, relative to the stride at the time the knobs were set
+// The cycle length moves in steps of CADSTEP and stays within the drive
+// limits; the knob value itself is not changed.
+void Param::cadence(const int ch, const double stride)
+{
+    if (ch < 0 || ch >= nch)
+        return;
+
+    if (strideRef[ch] <= 0)
+    {
+        strideRef[ch] = stride;
+        return;
+    }
+
+    const double cl = cPar[ch][3], ks = cPar[ch][1], kw = cPar[ch][2], kr = cPar[ch][0];
+
+    double target = cl*std::min(CADSLOW, std::max(CADFAST, stride/strideRef[ch]));
+    target = round(target/CADSTEP)*CADSTEP;
+
+    pvtLimits lim = cCurve[ch]->limits(target, ks, kw, kr, MAXVEL, MAXACC);
+    target = std::min(lim.clMax, std::max(ceil(lim.clMin/CADSTEP - 1e-9)*CADSTEP, target));
+
+    if (std::abs(target - clUsed[ch]) < CADSTEP/2)
+        return;
+
+    trajPtr traj;
+
+    switch (library.lookup(target, ks, kw, kr, traj))
+    {
+    case pvtLibrary::LIB_FEASIBLE:
+        break;
+
+    case pvtLibrary::LIB_UNFEASIBLE:
+        return;
+
+    case pvtLibrary::LIB_MISS:
+        cCurve[ch]->gen(target, ks, kw, kr);
+
+        if (!cCurve[ch]->check(MAXVEL, MAXACC))
+            return;
+
+        traj = cCurve[ch]->get();
+        break;
+    }
+
+    Log::print(LOG_INFO, "Stride of %s channel %.2f s (%.2f s at setting), cycle length %.2f s",
+               names[ch].c_str(), stride, strideRef[ch], target);
+
+    clUsed[ch] = target;
+    emit PVTSend(ch, traj);
+}
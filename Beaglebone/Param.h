@@ -2,40 +2,74 @@
 #define PARAM_H
 
 #include <QVector>
+#include <QByteArray>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include "PVT.h"
+#include "PVTLib.h"
 
 #define MAXVEL 12500
 #define MAXACC 1e6
 #define NPARAM 10
 
+#define GEARRATIO 160.0 // Gear ratio of the knee drives
+#define ENCQPR 4096     // Encoder quadcounts per revolution
+
+#define CADSLOW 1.6     // Longest cycle length from cadence adaptation, relative to the knob
+#define CADFAST 0.6     // Shortest cycle length from cadence adaptation, relative to the knob
+#define CADSTEP 0.02    // Cycle length steps of cadence adaptation (s)
+
 // Control parameters storage object
+// Runs in a worker thread of its own once set up: knob changes, curve
+// generation and file writes arrive as queued slots, only get() is called
+// from other threads
 class Param : public QObject
 {
     Q_OBJECT
 
 private:
-    char RL[3];
+    int nch;
+    std::vector<std::string> names;
     std::fstream paramFile;
     std::vector<std::unique_ptr<PVT>> cCurve;
+    pvtLibrary library;
+    bool stored;        // Settings file and trajectory library in use (not in benchmarks)
     QVector<QVector<double>> cPar;
+    std::mutex lock;    // Guards cPar against readers of other threads
+
+    // Cadence adaptation: stride period when the cycle length knob was set
+    // (0: not measured yet) and cycle length in use
+    std::vector<double> strideRef, clUsed;
 
     bool load();
+    pvtLimits limits(const int ch);
+    void unfeasible(const int ch);
 
 public:
-    Param();
+    Param(const std::vector<std::string> &chNames, const int nsteps = 6, const bool stored = true);
     ~Param();
 
-    bool save();
+    int channels() const { return nch; }
+    qint64 libraryTime() const { return library.loadTime(); }
+
     void setup();
     double get(const int ch, const int knob);
     bool set(const int ch, const int knob, const double val);
 
 signals:
     void paramSend(const int ch, const int knob, const double val);
-    void PVTSend(const int ch, const QVector<long> P, const QVector<long> V, const QVector<int> T);
+    void PVTSend(const int ch, const trajPtr traj);
+    void paramDone(const bool ok);
+    void feasibleDone(const QByteArray bounds);
+
+public slots:
+    bool save();
+    void request(const int ch, const int knob, const double val);
+    void feasible();
+    void cadence(const int ch, const double stride);
 };
 
 #endif // PARAM_H
@@ -0,0 +1,216 @@
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "Parser.h"
+#include "Clock.h"
+#include "Log.h"
+
+// razorParser constructor
+razorParser::razorParser(const unsigned int chmask, const bool counter) :
+    frames(0),
+    badFrames(0),
+    resyncBytes(0),
+    lostFrames(0)
+{
+    setLayout(chmask, counter);
+}
+
+// Set the frame layout and discard buffered bytes
+void razorParser::setLayout(const unsigned int chmask, const bool counter)
+{
+    mask = chmask & ALLCH;
+    seq = counter;
+
+    nfloats = 0;
+    for (int ch = 0; ch < MAXFLOATS; ch++)
+        if (mask & (1 << ch))
+            nfloats++;
+
+    size = 4*nfloats + (seq ? 3 : 2);
+
+    clear();
+}
+
+// Discard buffered bytes
+void razorParser::clear()
+{
+    head = 0;
+    tail = 0;
+    XOR = 0;
+    xvalid = false;
+    lastSeq = -1;
+}
+
+// Get pointer and length of the largest contiguous free block
+char *razorParser::writePtr(size_t &len)
+{
+    unsigned int start = tail & (RINGSIZE - 1);
+
+    len = RINGSIZE - start;
+    if (len > space())
+        len = space();
+
+    return &ring[start];
+}
+
+// Mark n bytes written at writePtr() as available
+void razorParser::commit(const size_t n)
+{
+    tail += n;
+}
+
+// Decode the next valid frame, skipping corrupted bytes
+// The checksum of the candidate frame is updated incrementally as the
+// window slides, so every buffered byte is visited a constant number of times.
+// Each float is stored at the index of its channel in q (MAXFLOATS wide)
+bool razorParser::next(float *q)
+{
+    while (available() >= static_cast<size_t>(size))
+    {
+        if (!xvalid)
+        {
+            XOR = 0;
+            for (int i = 1; i < size - 1; i++)
+                XOR ^= at(head + i);
+
+            xvalid = true;
+        }
+
+        if (static_cast<unsigned char>(at(head)) == 255)
+        {
+            if (at(head + size - 1) == XOR)
+            {
+                for (int i = 0; i < size; i++)
+                    frame[i] = at(head + i);
+
+                const char *p = &frame[1];
+
+                if (seq)
+                {
+                    int s = static_cast<unsigned char>(*p++);
+
+                    if (lastSeq >= 0)
+                        lostFrames += (s - lastSeq - 1) & 0xFF;
+
+                    lastSeq = s;
+                }
+
+                for (int ch = 0; ch < MAXFLOATS; ch++)
+                {
+                    if (mask & (1 << ch))
+                    {
+                        memcpy(&q[ch], p, sizeof(float));
+                        p += sizeof(float);
+                    }
+                }
+
+                head += size;
+                xvalid = false;
+                frames++;
+
+                return true;
+            }
+
+            badFrames++;
+        }
+
+        // Slide the window by one byte
+        XOR ^= at(head + 1) ^ at(head + size - 1);
+        head++;
+        resyncBytes++;
+    }
+
+    return false;
+}
+
+// Feed n frames through the parser at several byte corruption rates and log
+// the parsing throughput and how the frames were recovered
+// A corrupted byte is replaced by a random one or dropped, reads have random
+// sizes like those of the serial port
+//   chmask, counter: frame layout, as for the constructor
+void razorParser::bench(const int n, const unsigned int chmask, const bool counter)
+{
+    static const double rates[] = {0, 1e-4, 1e-3, 1e-2, 5e-2};
+
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> byte(0, 255), chunk(1, BENCHCHUNK);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    // Clean stream
+    razorParser layout(chmask, counter);
+    std::vector<char> clean;
+    clean.reserve(static_cast<size_t>(n)*layout.frameSize());
+
+    for (int f = 0; f < n; f++)
+    {
+        size_t start = clean.size();
+        clean.push_back(static_cast<char>(255));
+
+        if (counter)
+            clean.push_back(static_cast<char>(f & 0xFF));
+
+        for (int i = 0; i < layout.floats(); i++)
+        {
+            float v = static_cast<float>(unit(rng)*2 - 1);
+            const char *b = reinterpret_cast<const char *>(&v);
+            clean.insert(clean.end(), b, b + sizeof v);
+        }
+
+        char XOR = 0;
+        for (size_t i = start + 1; i < clean.size(); i++)
+            XOR ^= clean[i];
+
+        clean.push_back(XOR);
+    }
+
+    for (double rate : rates)
+    {
+        std::vector<char> stream;
+        stream.reserve(clean.size());
+
+        for (char c : clean)
+        {
+            if (unit(rng) >= rate)
+                stream.push_back(c);
+            else if (unit(rng) < 0.5)
+                stream.push_back(static_cast<char>(byte(rng)));
+        }
+
+        std::vector<int> reads;
+        for (size_t total = 0; total < stream.size(); total += reads.back())
+            reads.push_back(chunk(rng));
+
+        razorParser parser(chmask, counter);
+        float q[MAXFLOATS];
+        size_t pos = 0;
+
+        qint64 t0 = Clock::now();
+
+        for (int r : reads)
+        {
+            size_t end = std::min(stream.size(), pos + r);
+
+            // A read may wrap around the ring
+            while (pos < end)
+            {
+                size_t len;
+                char *ptr = parser.writePtr(len);
+                len = std::min(len, end - pos);
+
+                memcpy(ptr, &stream[pos], len);
+                parser.commit(len);
+                pos += len;
+            }
+
+            while (parser.next(q)) {}
+        }
+
+        qint64 t = std::max<qint64>(1, Clock::now() - t0);
+
+        Log::print(LOG_INFO, "Parser at %.2f%% corrupted bytes: %.1f MB/s, %lu of %d frames, %lu bad frames, "
+                   "%lu resync bytes, %lu lost frames", rate*100, stream.size()*1e3/t, parser.getFrames(), n,
+                   parser.getBadFrames(), parser.getResyncBytes(), parser.getLostFrames());
+    }
+}
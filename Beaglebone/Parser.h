@@ -0,0 +1,65 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <cstddef>
+
+#define MAXFLOATS 10                    // Channels in a full Razor frame
+#define MAXBUF (4*MAXFLOATS+3)          // Largest frame (header, sequence, floats, checksum)
+#define ALLCH ((1 << MAXFLOATS) - 1)    // Channel mask of the full frame
+
+#define RINGSIZE 1024 // Ring buffer size in bytes (power of two)
+#define BENCHCHUNK 64 // Largest read fed to the parser by the benchmark (bytes)
+
+// Razor binary frame parser over a byte ring buffer
+// Frame layout: 0xFF header, optional 8-bit sequence counter, one float per
+// channel set in the mask and the XOR of all bytes between header and checksum
+class razorParser
+{
+private:
+    char ring[RINGSIZE];
+    char frame[MAXBUF];
+
+    unsigned int mask;   // Channels present in a frame
+    bool seq;            // Frames carry a sequence counter
+    int nfloats;         // Floats per frame
+    int size;            // Frame size in bytes
+
+    unsigned int head;   // Read index (free running)
+    unsigned int tail;   // Write index (free running)
+    char XOR;            // Running checksum of the frame starting at head
+    bool xvalid;         // Running checksum is up to date
+
+    int lastSeq;               // Last sequence number received (-1: none)
+    unsigned long frames;      // Valid frames decoded
+    unsigned long badFrames;   // Frames with a valid header but a wrong checksum
+    unsigned long resyncBytes; // Bytes discarded while searching for a frame
+    unsigned long lostFrames;  // Gaps detected in the sequence counter
+
+    char at(const unsigned int i) const { return ring[i & (RINGSIZE - 1)]; }
+
+public:
+    razorParser(const unsigned int chmask = ALLCH, const bool counter = false);
+
+    void setLayout(const unsigned int chmask, const bool counter);
+    void clear();
+
+    int frameSize() const { return size; }
+    int floats() const { return nfloats; }
+
+    size_t available() const { return tail - head; }
+    size_t space() const { return RINGSIZE - available(); }
+
+    char *writePtr(size_t &len);
+    void commit(const size_t n);
+
+    bool next(float *q);
+
+    unsigned long getFrames() const { return frames; }
+    unsigned long getBadFrames() const { return badFrames; }
+    unsigned long getResyncBytes() const { return resyncBytes; }
+    unsigned long getLostFrames() const { return lostFrames; }
+
+    static void bench(const int n, const unsigned int chmask, const bool counter);
+};
+
+#endif // PARSER_H
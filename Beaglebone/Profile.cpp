@@ -0,0 +1,159 @@
+#include <cstdio>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+
+#include "Profile.h"
+#include "Log.h"
+
+static const char *stageName[ST_NSTAGE] =
+    {"decode", "age", "angle", "control", "frame", "wait-cmd", "wait-upl", "wait-tel", "vcs"};
+
+// Initialize static variables
+latencyHist Profile::hist[ST_NSTAGE];
+
+// latencyHist constructor
+latencyHist::latencyHist()
+{
+    reset();
+}
+
+// Bucket of a duration: bucket 0 holds everything below 2^HISTLOG ns, then
+// HISTSUB buckets per octave, the last one is open
+int latencyHist::bucket(const qint64 ns)
+{
+    if (ns < (1LL << HISTLOG))
+        return 0;
+
+    int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(ns));
+    int sub = static_cast<int>(ns >> (msb - 2)) & (HISTSUB - 1);
+    int b = 1 + (msb - HISTLOG)*HISTSUB + sub;
+
+    return b < HISTBKT ? b : HISTBKT - 1;
+}
+
+// Lower bound of a bucket (ns)
+qint64 latencyHist::lower(const int b)
+{
+    if (b <= 0)
+        return 0;
+
+    int octave = (b - 1)/HISTSUB + HISTLOG;
+    int sub = (b - 1)%HISTSUB;
+
+    return static_cast<qint64>(HISTSUB + sub) << (octave - 2);
+}
+
+// Count one duration (ns), from any thread
+void latencyHist::record(const qint64 ns)
+{
+    count[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    n.fetch_add(1, std::memory_order_relaxed);
+
+    qint64 m = max.load(std::memory_order_relaxed);
+    while (ns > m && !max.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+        ;
+}
+
+// Clear all counts
+void latencyHist::reset()
+{
+    for (int b = 0; b < HISTBKT; b++)
+        count[b] = 0;
+
+    n = 0;
+    max = 0;
+}
+
+// Upper bound of the bucket holding quantile p (ns), capped by the maximum
+qint64 latencyHist::percentile(const double p) const
+{
+    unsigned long total = n;
+    if (total == 0)
+        return 0;
+
+    unsigned long rank = static_cast<unsigned long>(p*total + 0.5);
+    unsigned long seen = 0;
+
+    for (int b = 0; b < HISTBKT - 1; b++)
+    {
+        seen += count[b];
+
+        if (seen >= rank && seen > 0)
+            return std::min<qint64>(lower(b + 1), max);
+    }
+
+    return max;
+}
+
+// Clear the histograms of all stages
+void Profile::reset()
+{
+    for (int s = 0; s < ST_NSTAGE; s++)
+        hist[s].reset();
+}
+
+// One line per stage: count, median, 90th and 99th percentile, maximum (us)
+std::string Profile::summary()
+{
+    std::ostringstream out;
+    char line[100];
+
+    snprintf(line, sizeof line, "%-9s %9s %9s %9s %9s %9s\n", "stage", "count", "p50", "p90", "p99", "max");
+    out << line;
+
+    for (int s = 0; s < ST_NSTAGE; s++)
+    {
+        const latencyHist &h = hist[s];
+
+        if (h.samples() == 0)
+            continue;
+
+        snprintf(line, sizeof line, "%-9s %9lu %9.1f %9.1f %9.1f %9.1f\n", stageName[s], h.samples(),
+                 h.percentile(0.5)/1000.0, h.percentile(0.9)/1000.0, h.percentile(0.99)/1000.0,
+                 h.maximum()/1000.0);
+        out << line;
+    }
+
+    return out.str();
+}
+
+// Log the summary, one message per line
+void Profile::report()
+{
+    std::istringstream lines(summary());
+    std::string line;
+
+    Log::print(LOG_INFO, "Stage latency (us):");
+
+    while (std::getline(lines, line))
+        Log::print(LOG_INFO, "  %s", line.c_str());
+}
+
+// Write the bucket counts: lower bound (ns) followed by one column per stage
+void Profile::dump(const std::string pathDate)
+{
+    std::string file = pathDate + "-Lat.txt";
+    std::ofstream outFile(file);
+
+    if (!outFile.is_open())
+        return;
+
+    Log::print(LOG_INFO, "Writing stage latency histograms to %s", file.c_str());
+
+    outFile << "#  lower(ns)";
+    for (int s = 0; s < ST_NSTAGE; s++)
+        outFile << std::setw(10) << stageName[s];
+    outFile << std::endl;
+
+    for (int b = 0; b < HISTBKT; b++)
+    {
+        outFile << std::setw(12) << latencyHist::lower(b);
+
+        for (int s = 0; s < ST_NSTAGE; s++)
+            outFile << std::setw(10) << hist[s].samples(b);
+
+        outFile << std::endl;
+    }
+}
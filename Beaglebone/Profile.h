@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <atomic>
+#include <string>
+
+#include <QtGlobal>
+
+#define HISTLOG 10      // First octave of the histograms: 2^10 ns (about 1 us)
+#define HISTOCT 22      // Octaves covered, up to about 4 s
+#define HISTSUB 4       // Buckets per octave
+#define HISTBKT (1 + HISTOCT*HISTSUB)
+
+// Stages of the control pipeline
+enum stage
+{
+    ST_DECODE,          // AHRS data arrival to sample published
+    ST_AGE,             // AHRS sample published to used by a control frame
+    ST_ANGLE,           // Segment angles and accelerations of a frame
+    ST_CONTROL,         // One motorControl state machine step
+    ST_FRAME,           // Whole control frame
+    ST_WAITCMD,         // Bus queue wait of commands
+    ST_WAITUPL,         // Bus queue wait of trajectory uploads
+    ST_WAITTEL,         // Bus queue wait of telemetry reads
+    ST_VCS,             // Bus job, VCS_* calls included
+    ST_NSTAGE
+};
+
+// Duration histogram with logarithmic buckets, updated without locks
+class latencyHist
+{
+private:
+    std::atomic<unsigned long> count[HISTBKT];
+    std::atomic<unsigned long> n;
+    std::atomic<qint64> max;
+
+public:
+    latencyHist();
+
+    static int bucket(const qint64 ns);
+    static qint64 lower(const int b);
+
+    void record(const qint64 ns);
+    void reset();
+
+    unsigned long samples() const { return n; }
+    unsigned long samples(const int b) const { return count[b]; }
+    qint64 maximum() const { return max; }
+    qint64 percentile(const double p) const;
+};
+
+// Latency histograms of all pipeline stages
+class Profile
+{
+private:
+    static latencyHist hist[ST_NSTAGE];
+
+public:
+    static void record(const stage s, const qint64 ns) { hist[s].record(ns); }
+    static void reset();
+
+    static std::string summary();
+    static void report();
+    static void dump(const std::string pathDate);
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "RtLoop.h"
+#include "Clock.h"
+#include "Log.h"
+
+// rtLoop constructor
+rtLoop::rtLoop(const rtConfig &config) :
+    cfg(config), running(false), period(0), first(0), event(nullptr), timeout(0), lateSum(0), lateMax(0), frames(0),
+    overruns(0), timeouts(0) {}
+
+// rtLoop destructor
+rtLoop::~rtLoop()
+{
+    stop();
+}
+
+// Start the thread
+//   start: first deadline (monotonic ns)
+//   ns: frame period
+//   frame: called once per deadline
+void rtLoop::start(const qint64 start, const qint64 ns, std::function<void(qint64)> frame)
+{
+    if (running)
+        return;
+
+    first = start;
+    period = ns;
+    body = frame;
+    event = nullptr;
+
+    lateSum = 0;
+    lateMax = 0;
+    frames = 0;
+    overruns = 0;
+
+    running = true;
+    worker = std::thread(&rtLoop::run, this);
+}
+
+// Start the thread in triggered mode
+//   ev: signalled by the producers
+//   cond: true when a frame can run, sets the time the newest input was published
+//   ns: timeout after the last frame, a frame runs anyway when it expires
+//   frame: called with the publish time of the input that triggered the
+//          frame, or the timeout
+void rtLoop::start(frameEvent &ev, std::function<bool(qint64 &)> cond, const qint64 ns,
+                   std::function<void(qint64)> frame)
+{
+    if (running)
+        return;
+
+    event = &ev;
+    ready = cond;
+    timeout = ns;
+    body = frame;
+
+    lateSum = 0;
+    lateMax = 0;
+    frames = 0;
+    overruns = 0;
+    timeouts = 0;
+
+    running = true;
+    worker = std::thread(&rtLoop::runTriggered, this);
+}
+
+// Stop and join the thread, within one period
+void rtLoop::stop()
+{
+    if (running)
+    {
+        running = false;
+        worker.join();
+    }
+}
+
+// Wake-up latency and overrun summary
+void rtLoop::report()
+{
+    if (frames > 0 && event)
+    {
+        Log::print(LOG_INFO, "Triggered loop: %lu frames, %lu on timeout, latency after sample mean %lld us, max %lld us",
+                   frames, timeouts, lateSum/static_cast<qint64>(frames)/1000, lateMax/1000);
+    }
+    else if (frames > 0)
+    {
+        Log::print(LOG_INFO, "Real-time loop: %lu frames, wake-up latency mean %lld us, max %lld us, %lu skipped",
+                   frames, lateSum/static_cast<qint64>(frames)/1000, lateMax/1000, overruns);
+    }
+}
+
+// Scheduling policy, affinity and memory locking of the calling thread
+void rtLoop::setup()
+{
+    if (!cfg.enabled)
+        return;
+
+    sched_param sp;
+    sp.sched_priority = cfg.priority;
+
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (err != 0)
+        Log::print(LOG_WARN, "Real-time loop: SCHED_FIFO %d refused (%s)", cfg.priority, strerror(err));
+
+    if (cfg.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg.cpu, &set);
+
+        err = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        if (err != 0)
+            Log::print(LOG_WARN, "Real-time loop: cannot pin to CPU %d (%s)", cfg.cpu, strerror(err));
+    }
+
+    // Keep current and future pages resident, and fault in the stack now
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        Log::print(LOG_WARN, "Real-time loop: cannot lock memory (%s)", strerror(errno));
+
+    volatile char stack[RTSTACK];
+    memset(const_cast<char *>(stack), 0, sizeof stack);
+
+    Log::print(LOG_INFO, "Real-time loop: priority %d, CPU %d, period %lld us", cfg.priority, cfg.cpu, period/1000);
+}
+
+// Frame loop
+void rtLoop::run()
+{
+    setup();
+
+    // Deadlines that passed during the setup are not overruns
+    qint64 due = first;
+    qint64 behind = Clock::now() - due;
+    if (behind > 0)
+        due += (behind/period + 1)*period;
+
+    while (running)
+    {
+        timespec ts;
+        ts.tv_sec = due/1000000000;
+        ts.tv_nsec = due%1000000000;
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+            ;
+
+        if (!running)
+            break;
+
+        qint64 late = Clock::now() - due;
+        lateSum += late;
+        if (late > lateMax)
+            lateMax = late;
+        frames++;
+
+        body(due);
+
+        // Skip the deadlines that have already passed
+        due += period;
+
+        behind = Clock::now() - due;
+        if (behind > 0)
+        {
+            qint64 n = behind/period + 1;
+            due += n*period;
+            overruns += n;
+        }
+    }
+}
+
+// Triggered frame loop: a frame runs as soon as the condition holds after
+// an event, or when no frame has run for the timeout
+void rtLoop::runTriggered()
+{
+    setup();
+
+    unsigned long seen = 0;
+    qint64 last = Clock::now();
+
+    while (running)
+    {
+        qint64 deadline = last + timeout;
+        qint64 published = 0;
+        bool triggered = false;
+
+        // Wake up at least every RTPOLL ms to check "running"
+        while (running && !(triggered = ready(published)))
+        {
+            if (!event->wait(seen, std::min(deadline, Clock::now() + RTPOLL*1000000LL)) &&
+                Clock::now() >= deadline)
+                break;
+        }
+
+        if (!running)
+            break;
+
+        qint64 now = Clock::now();
+        // Wake-up latency is counted from the publication of the input
+        qint64 due = triggered ? std::min(now, published) : deadline;
+
+        if (!triggered)
+            timeouts++;
+
+        qint64 late = now - due;
+        lateSum += late;
+        if (late > lateMax)
+            lateMax = late;
+        frames++;
+
+        body(due);
+
+        last = now;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef RTLOOP_H
+#define RTLOOP_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include <QtGlobal>
+
+#include "Channel.h"
+
+#define RTSTACK (256*1024)  // Stack prefaulted by the real-time thread (bytes)
+#define RTPOLL 100          // Longest wait of the triggered loop before checking for stop (ms)
+
+// Control loop executor settings
+struct rtConfig
+{
+    bool enabled;       // Run the loop under SCHED_FIFO in its own thread instead of a Qt timer
+    int priority;       // SCHED_FIFO priority (1-99)
+    int cpu;            // CPU the thread is pinned to (-1: no affinity)
+    bool triggered;     // Run a frame when the sensors deliver new samples, in its own thread
+};
+
+// Control loop thread, either periodic, woken on absolute deadlines of
+// CLOCK_MONOTONIC, or triggered by an event with a timeout
+// When enabled the thread runs under SCHED_FIFO pinned to one CPU, with the
+// process memory locked; if the system refuses any of these it runs without
+// it. Periodic frames that cannot start before the next deadline are skipped
+// and counted.
+class rtLoop
+{
+private:
+    rtConfig cfg;
+    std::thread worker;
+    std::atomic<bool> running;
+
+    qint64 period;                      // Frame period (ns)
+    qint64 first;                       // First deadline (monotonic ns)
+    std::function<void(qint64)> body;   // Frame function, gets the deadline
+
+    // Triggered mode: event, condition that starts a frame and timeout (ns)
+    frameEvent *event;
+    std::function<bool(qint64 &)> ready;
+    qint64 timeout;
+
+    // Wake-up latency after the deadline (ns), skipped frames, frames run on timeout
+    qint64 lateSum, lateMax;
+    unsigned long frames, overruns, timeouts;
+
+    void setup();
+    void run();
+    void runTriggered();
+
+public:
+    rtLoop(const rtConfig &config);
+    ~rtLoop();
+
+    void start(const qint64 start, const qint64 ns, std::function<void(qint64)> frame);
+    void start(frameEvent &ev, std::function<bool(qint64 &)> cond, const qint64 ns, std::function<void(qint64)> frame);
+    void stop();
+    void report();
+};
+
+#endif // RTLOOP_H
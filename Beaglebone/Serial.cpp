@@ -0,0 +1,228 @@
+#include <iostream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/serial.h>
+
+#include "Serial.h"
+#include "Clock.h"
+#include "AHRS.h"
+
+// rawSerial constructor
+rawSerial::rawSerial() : fd(-1) {}
+
+// rawSerial destructor
+rawSerial::~rawSerial()
+{
+    close();
+}
+
+// Open a tty in raw, non-blocking mode
+//   baud: line speed (bps)
+//   vmin: bytes the driver collects before reporting the port as readable
+bool rawSerial::open(const std::string &path, const int baud, const int vmin)
+{
+    fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    if (!configure(baud, vmin))
+    {
+        close();
+        return false;
+    }
+
+    // Ask the UART driver to push received bytes immediately (not all drivers support it)
+    serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0)
+    {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &ss);
+    }
+
+    tcflush(fd, TCIOFLUSH);
+
+    return true;
+}
+
+// Set line speed and wake-up threshold
+bool rawSerial::configure(const int baud, const int vmin)
+{
+    speed_t speed;
+
+    switch (baud)
+    {
+    case 57600:  speed = B57600;  break;
+    case 115200: speed = B115200; break;
+    case 230400: speed = B230400; break;
+    case 460800: speed = B460800; break;
+    case 921600: speed = B921600; break;
+    default:
+        return false;
+    }
+
+    termios tio;
+    if (tcgetattr(fd, &tio) < 0)
+        return false;
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+
+    // Wake readers once a whole frame is buffered, without inter-byte timer
+    tio.c_cc[VMIN] = vmin;
+    tio.c_cc[VTIME] = 0;
+
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+// Close the tty
+void rawSerial::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// Number of bytes waiting in the input queue
+qint64 rawSerial::bytesAvailable()
+{
+    int n = 0;
+
+    if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0)
+        return 0;
+
+    return n;
+}
+
+// Read up to len bytes without blocking
+qint64 rawSerial::read(char *buf, const qint64 len)
+{
+    ssize_t n = ::read(fd, buf, len);
+
+    return n < 0 ? 0 : n;
+}
+
+// Write a command and wait until it has been transmitted
+bool rawSerial::write(const char *buf, const qint64 len)
+{
+    qint64 sent = 0;
+
+    while (sent < len)
+    {
+        ssize_t n = ::write(fd, buf + sent, len - sent);
+
+        if (n < 0)
+        {
+            pollfd pfd = {fd, POLLOUT, 0};
+            if (poll(&pfd, 1, 100) <= 0)
+                return false;
+        }
+        else
+            sent += n;
+    }
+
+    return tcdrain(fd) == 0;
+}
+
+// Wait for input (ms < 0 waits forever)
+bool rawSerial::waitForReadyRead(const int ms)
+{
+    pollfd pfd = {fd, POLLIN, 0};
+
+    return poll(&pfd, 1, ms) > 0;
+}
+
+// serialPoller constructor
+serialPoller::serialPoller() : running(false)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+}
+
+// serialPoller destructor
+serialPoller::~serialPoller()
+{
+    stop();
+
+    ::close(evfd);
+    ::close(epfd);
+}
+
+// Register the port of an AHRS in the epoll set
+bool serialPoller::add(AHRS *ahrs)
+{
+    if (ahrs->handle() < 0)
+        return false;
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = ahrs;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, ahrs->handle(), &ev) == 0;
+}
+
+// Start the polling thread
+void serialPoller::start()
+{
+    if (!running)
+    {
+        running = true;
+        worker = std::thread(&serialPoller::loop, this);
+    }
+}
+
+// Stop and join the polling thread
+void serialPoller::stop()
+{
+    if (running)
+    {
+        running = false;
+
+        uint64_t one = 1;
+        if (::write(evfd, &one, sizeof one) < 0)
+            std::cout << "Error waking serial poller" << std::endl;
+
+        worker.join();
+
+        uint64_t cnt;
+        if (::read(evfd, &cnt, sizeof cnt) < 0)
+            cnt = 0;
+    }
+}
+
+// Polling loop, frames are timestamped as soon as epoll returns
+void serialPoller::loop()
+{
+    epoll_event events[8];
+
+    while (running)
+    {
+        int n = epoll_wait(epfd, events, 8, -1);
+        qint64 stamp = Clock::now();
+
+        for (int i = 0; i < n; i++)
+        {
+            AHRS *ahrs = static_cast<AHRS *>(events[i].data.ptr);
+
+            if (ahrs)
+                ahrs->decode(stamp);
+        }
+    }
+}
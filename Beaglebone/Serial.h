@@ -0,0 +1,54 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <QtGlobal>
+
+class AHRS;
+
+// Serial port opened in raw mode through termios
+class rawSerial
+{
+private:
+    int fd;
+
+public:
+    rawSerial();
+    ~rawSerial();
+
+    bool open(const std::string &path, const int baud, const int vmin);
+    bool configure(const int baud, const int vmin);
+    void close();
+
+    int handle() const { return fd; }
+
+    qint64 bytesAvailable();
+    qint64 read(char *buf, const qint64 len);
+    bool write(const char *buf, const qint64 len);
+    bool waitForReadyRead(const int ms);
+};
+
+// Single epoll loop serving the raw serial ports of several AHRS
+class serialPoller
+{
+private:
+    int epfd;                   // epoll instance
+    int evfd;                   // eventfd used to wake the loop on stop
+    std::thread worker;
+    std::atomic<bool> running;
+
+    void loop();
+
+public:
+    serialPoller();
+    ~serialPoller();
+
+    bool add(AHRS *ahrs);
+    void start();
+    void stop();
+};
+
+#endif // SERIAL_H
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "Topology.h"
+
+// Topology constructor
+Topology::Topology()
+{
+    defaults();
+}
+
+// Pair of knee orthoses with one thigh AHRS each
+void Topology::defaults()
+{
+    sensors.clear();
+    joints.clear();
+
+    sensors.push_back(sensorCfg{"ttyO2",  1});
+    sensors.push_back(sensorCfg{"ttyO4", -1});
+
+    // Right motor is reversed
+    joints.push_back(jointCfg{"R", 0, 1, true,  5000, 'R'});
+    joints.push_back(jointCfg{"L", 1, 0, false, 5000, 'L'});
+}
+
+// Load topology from file, keeping the defaults if it is missing or invalid
+//   imu   <port> <sign>
+//   joint <name> <own imu> <opposite imu> <reverse> <offset> <gains>
+// IMUs are numbered from 1 in order of appearance; '#' starts a comment
+bool Topology::load(const std::string &file)
+{
+    std::ifstream topoFile(file);
+
+    if (!topoFile.is_open())
+    {
+        std::cout << "No " << file << ", using default topology" << std::endl;
+        return false;
+    }
+
+    std::cout << "Loading topology from " << file << std::endl;
+
+    sensors.clear();
+    joints.clear();
+
+    std::string line;
+    int n = 0;
+
+    while (std::getline(topoFile, line))
+    {
+        n++;
+
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string kind;
+
+        if (!(fields >> kind))
+            continue;
+
+        bool ok;
+
+        if (kind == "imu")
+        {
+            std::string port;
+            sensorCfg s;
+
+            ok = static_cast<bool>(fields >> port >> s.sign);
+            s.port = QString::fromStdString(port);
+
+            if (ok)
+                sensors.push_back(s);
+        }
+        else if (kind == "joint")
+        {
+            jointCfg j;
+
+            ok = static_cast<bool>(fields >> j.name >> j.own >> j.opp >> j.reverse >> j.offset >> j.gains);
+            j.own--;
+            j.opp--;
+
+            if (ok)
+                joints.push_back(j);
+        }
+        else
+            ok = false;
+
+        if (!ok)
+            std::cout << "  Ignoring line " << n << " of " << file << std::endl;
+    }
+
+    if (!check())
+    {
+        std::cout << "Invalid topology, using defaults" << std::endl;
+        defaults();
+        return false;
+    }
+
+    return true;
+}
+
+// Check that every joint refers to existing sensors
+bool Topology::check()
+{
+    if (sensors.empty() || joints.empty())
+        return false;
+
+    for (const jointCfg &j : joints)
+    {
+        if (j.own < 0 || j.own >= static_cast<int>(sensors.size()) ||
+            j.opp < 0 || j.opp >= static_cast<int>(sensors.size()))
+            return false;
+    }
+
+    return true;
+}
+
+// Joint names, in channel order
+std::vector<std::string> Topology::names() const
+{
+    std::vector<std::string> n;
+
+    for (const jointCfg &j : joints)
+        n.push_back(j.name);
+
+    return n;
+}
@@ -0,0 +1,44 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+#include <QString>
+
+// AHRS description
+struct sensorCfg
+{
+    QString port;       // Serial port
+    int sign;           // Pitch sign (-1 for sensors mounted mirrored)
+};
+
+// Actuated joint description
+struct jointCfg
+{
+    std::string name;   // Channel name shown in messages
+    int own;            // Sensor on the same segment
+    int opp;            // Sensor on the opposite segment
+    bool reverse;       // Motor rotation is reversed
+    long offset;        // Homing offset (qc)
+    char gains;         // Regulator gain set from MotorConfig.h ('R' or 'L')
+};
+
+// Sensors and joints of the orthosis, read from a configuration file
+class Topology
+{
+private:
+    bool check();
+
+public:
+    std::vector<sensorCfg> sensors;
+    std::vector<jointCfg> joints;
+
+    Topology();
+
+    void defaults();
+    bool load(const std::string &file);
+    std::vector<std::string> names() const;
+};
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,53 @@
+#include "Trace.h"
+#include "Clock.h"
+#include "Log.h"
+
+static const char *hopName[HOP_NHOP] = {"detect", "delay", "signal", "queue", "vcs", "trigger", "total"};
+
+// Initialize static variables
+latencyHist Trace::hops[HOP_NHOP];
+
+// Log a completed swing and add its hops to the statistics, from any thread
+void Trace::swing(const swingTrace &t)
+{
+    qint64 d[HOP_NHOP];
+
+    d[HOP_DETECT] = t.detect - t.imu;
+    d[HOP_DELAY] = t.fire - t.detect;
+    d[HOP_SIGNAL] = t.post - t.fire;
+    d[HOP_QUEUE] = t.start - t.post;
+    d[HOP_VCS] = t.done - t.start;
+    d[HOP_TOTAL] = t.done - t.imu;
+    d[HOP_TRIGGER] = d[HOP_TOTAL] - d[HOP_DELAY];
+
+    for (int h = 0; h < HOP_NHOP; h++)
+        hops[h].record(d[h]);
+
+    Log::print(LOG_INFO, "Swing %d, AHRS frame at %.6f s: detect %.1f, fire %.1f, post %.1f, bus %.1f, start %.1f ms",
+               t.motor, Clock::seconds(t.imu), d[HOP_DETECT]/1e6, (t.fire - t.imu)/1e6, (t.post - t.imu)/1e6,
+               (t.start - t.imu)/1e6, (t.done - t.imu)/1e6);
+}
+
+// Clear the statistics
+void Trace::reset()
+{
+    for (int h = 0; h < HOP_NHOP; h++)
+        hops[h].reset();
+}
+
+// Log the statistics of each hop
+void Trace::report()
+{
+    if (hops[HOP_TOTAL].samples() == 0)
+        return;
+
+    Log::print(LOG_INFO, "Swing latency over %lu swings (ms): p50, p90, p99, max", hops[HOP_TOTAL].samples());
+
+    for (int h = 0; h < HOP_NHOP; h++)
+    {
+        const latencyHist &l = hops[h];
+
+        Log::print(LOG_INFO, "  %-8s %8.2f %8.2f %8.2f %8.2f", hopName[h], l.percentile(0.5)/1e6,
+                   l.percentile(0.9)/1e6, l.percentile(0.99)/1e6, l.maximum()/1e6);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "Profile.h"
+
+// Timestamps (monotonic ns) of one swing from the IMU frame to the drive
+struct swingTrace
+{
+    int motor;
+    qint64 imu;         // Arrival of the AHRS frame used by the detecting control frame
+    qint64 detect;      // Control frame that detected the heel-off
+    qint64 fire;        // Control frame that ended the "it" delay and sent the run command
+    qint64 post;        // Run command received by the motor, queued on the bus
+    qint64 start;       // Bus job started, VCS_StartIpmTrajectory called
+    qint64 done;        // VCS_StartIpmTrajectory returned
+};
+
+// Hops of a swing trace
+enum swingHop
+{
+    HOP_DETECT,         // AHRS frame to heel-off detection
+    HOP_DELAY,          // Detection to run command ("it" delay)
+    HOP_SIGNAL,         // Run command to motor slot
+    HOP_QUEUE,          // Motor slot to bus job
+    HOP_VCS,            // VCS_StartIpmTrajectory call
+    HOP_TRIGGER,        // AHRS frame to trajectory start, without the "it" delay
+    HOP_TOTAL,          // AHRS frame to trajectory start
+    HOP_NHOP
+};
+
+// Swing event traces in the session log, with per-hop statistics
+class Trace
+{
+private:
+    static latencyHist hops[HOP_NHOP];
+
+public:
+    static void swing(const swingTrace &t);
+    static void reset();
+    static void report();
+};
+
+#endif // TRACE_H
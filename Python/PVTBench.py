@@ -0,0 +1,99 @@
+#!/usr/bin/python
+# coding: latin-1
+
+# PVT point count benchmark
+#
+# Generates the swing trajectory like PVT::gen() for several numbers of
+# intervals and compares the cubic interpolation done by the EPOS2 with the
+# analytic curve. Shows how many points exceed the IPM buffer and have to be
+# streamed while the trajectory runs. Tracking error on the drive itself is
+# logged by Orthosis when the data recorder is enabled (--recorder).
+#
+# Example:
+#   ./PVTBench.py --steps 6 12 24 48 96 --cycle 0.7
+
+import math, argparse
+
+GEAR = 160.0
+QPR = 4096
+
+
+# Analytic knee angle (deg) at time t of a cycle of length cl
+def curve(t, cl, ks, kw, kr):
+	wt = 2*math.pi/cl*t
+	ph = ks*math.sin(wt/2) + kw*math.sin(wt)
+	return kr/2*(1 - math.cos(wt - ph))
+
+
+# PVT points (qc, rpm, ms) as generated by PVT::gen()
+def gen(ns, cl, ks, kw, kr):
+	qpd = QPR*GEAR/360
+	dt = round(cl/ns*1000)/1000
+	cl = ns*dt
+
+	pts = []
+	for i in range(ns):
+		t = dt*(i + 1)
+		wt = 2*math.pi/cl*t
+		ph = ks*math.sin(wt/2) + kw*math.sin(wt)
+		pos = kr/2*(1 - math.cos(wt - ph))
+		vel = kr*math.pi/cl*(math.sin(wt - ph)*(1 - ks/2*math.cos(wt/2) - kw*math.cos(wt)))
+		pts.append((round(pos*qpd), round(vel*GEAR/6), int(round(dt*1000))))
+
+	pts.append((0, 0, 0))
+	return pts, cl
+
+
+# Output angle (deg) interpolated by the drive at time t
+def interp(pts, t):
+	qpd = QPR*GEAR/360
+	p0, v0, t0 = 0.0, 0.0, 0.0
+
+	for p, v, ms in pts:
+		if ms <= 0:
+			break
+
+		dt = ms/1000.0
+		p1 = p/qpd
+		v1 = v*6/GEAR
+
+		if t <= t0 + dt:
+			s = t - t0
+			a = (2*(p0 - p1) + dt*(v0 + v1))/dt**3
+			b = (3*(p1 - p0) - dt*(2*v0 + v1))/dt**2
+			return p0 + s*(v0 + s*(b + s*a))
+
+		p0, v0, t0 = p1, v1, t0 + dt
+
+	return p0
+
+
+def main():
+	p = argparse.ArgumentParser(description = "PVT interpolation accuracy against point count")
+	p.add_argument('-n', '--steps', type = int, nargs = '+', default = [6, 12, 24, 48, 96, 192])
+	p.add_argument('-c', '--cycle', type = float, default = 0.70, help = "cycle length (s)")
+	p.add_argument('--ks', type = float, default = 0.16)
+	p.add_argument('--kw', type = float, default = -0.1)
+	p.add_argument('--kr', type = float, default = 40.0, help = "maximum knee flexion (deg)")
+	p.add_argument('-b', '--buffer', type = int, default = 64, help = "IPM buffer size (points)")
+	args = p.parse_args()
+
+	print("%6s %6s %7s %9s %10s %10s" % ("steps", "dt ms", "points", "streamed", "rms deg", "max deg"))
+
+	for ns in args.steps:
+		pts, cl = gen(ns, args.cycle, args.ks, args.kw, args.kr)
+
+		sq, mx, n = 0.0, 0.0, 0
+		t = 0.0
+		while t <= cl:
+			err = abs(interp(pts, t) - curve(t, cl, args.ks, args.kw, args.kr))
+			sq += err*err
+			mx = max(mx, err)
+			n += 1
+			t += 0.0005
+
+		print("%6i %6i %7i %9i %10.4f %10.4f" % (ns, pts[0][2], len(pts),
+			max(0, len(pts) - args.buffer), math.sqrt(sq/n), mx))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,292 @@
+#!/usr/bin/python
+# coding: latin-1
+
+# Razor AHRS simulator
+#
+# Creates one pseudo-terminal per IMU and speaks the binary protocol expected
+# by the AHRS class: "#o0" stops the output, "#o1" starts it and "#oab" selects
+# binary frames (0xFF header, optional sequence byte, little-endian floats and
+# the XOR of the bytes between header and checksum). The streaming mode is set
+# with "#om<hex channel mask>", "#os<0|1>" (sequence counter), "#oi<ms>" (output
+# interval) and "#b<bps>" (line speed, ignored on a pty). Frames come from a
+# synthetic gait model or from the -Rzr<N>.txt files written by AHRS::dump().
+#
+# Example:
+#   ./RazorSim.py --link /tmp/ttyRzr &
+#   ./Orthosis --raw --imu-fast /tmp/ttyRzr1 /tmp/ttyRzr2
+#
+# A cadence ramp, or the replay of a recorded session, exercises the cycle
+# length adaptation of "Orthosis --cadence":
+#   ./RazorSim.py --link /tmp/ttyRzr --cadence 0.8 --cadence-to 1.1 --ramp 60 &
+
+import os, re, sys, time, math, random, struct, select, signal, argparse, tty
+
+NFLOATS = 10
+ALLCH = (1 << NFLOATS) - 1
+
+
+# Simulated Razor IMU attached to a pseudo-terminal
+class Razor(object):
+	def __init__(self, id, source, link = None):
+		self.id = id
+		self.source = source
+		self.streaming = False
+		self.cmd = b""
+		self.reset()
+
+		self.master, slave = os.openpty()
+		tty.setraw(slave)
+		self.name = os.ttyname(slave)
+
+		# Keep the slave open so that the master does not see a hangup
+		self.slave = slave
+
+		if link:
+			self.link = link + str(id)
+			if os.path.lexists(self.link):
+				os.remove(self.link)
+			os.symlink(self.name, self.link)
+		else:
+			self.link = None
+
+	def close(self):
+		if self.link and os.path.lexists(self.link):
+			os.remove(self.link)
+		os.close(self.master)
+		os.close(self.slave)
+
+	# Power-up streaming mode
+	def reset(self):
+		self.mask = ALLCH
+		self.seq = None
+		self.interval = None
+		self.baud = 57600
+
+	# Parse commands sent by the AHRS class (each write holds whole commands)
+	def command(self):
+		try:
+			self.cmd += os.read(self.master, 1024)
+		except OSError:
+			return
+
+		for cmd, arg in re.findall(br"#(o[01]|oa|om|os|oi|b)([0-9a-fA-F]*)", self.cmd):
+			if cmd == b"o0":
+				self.streaming = False
+			elif cmd == b"o1":
+				self.streaming = True
+			elif cmd == b"oa":
+				# "#oab": binary output, restart the source
+				self.source.rewind()
+			elif cmd == b"om" and arg:
+				self.mask = int(arg, 16) & ALLCH
+			elif cmd == b"os" and arg:
+				self.seq = 0 if int(arg) else None
+			elif cmd == b"oi" and arg:
+				self.interval = int(arg)/1000.0 if int(arg) else None
+			elif cmd == b"b" and arg:
+				self.baud = int(arg)
+
+		self.cmd = b""
+
+	# Build a binary frame in the current layout
+	def frame(self, q):
+		body = b""
+		if self.seq is not None:
+			body += struct.pack('B', self.seq)
+			self.seq = (self.seq + 1) & 0xFF
+
+		ch = [q[i] for i in range(NFLOATS) if self.mask & (1 << i)]
+		body += struct.pack('<%if' % len(ch), *ch)
+
+		xor = 0
+		for b in bytearray(body):
+			xor ^= b
+		return b"\xff" + body + struct.pack('B', xor)
+
+	def write(self, data):
+		try:
+			os.write(self.master, data)
+		except OSError:
+			pass
+
+
+# Synthetic gait: thigh pitch oscillates with the stride and a vertical
+# acceleration dip marks each heel-off. The stride frequency goes linearly
+# from "cadence" to "final" over "ramp" seconds, then stays.
+class Gait(object):
+	def __init__(self, side, rate, cadence, amplitude, final = None, ramp = 0.0):
+		self.side = side
+		self.period = 1.0/rate
+		self.cadence = cadence
+		self.final = cadence if final is None else final
+		self.ramp = ramp
+		self.amp = amplitude
+		self.rewind()
+
+	def rewind(self):
+		self.t = 0.0
+		self.ph = 0.0
+
+	def next(self):
+		ph = self.ph
+		if self.side == 2:
+			ph += math.pi
+
+		# Pitch about the x axis, left thigh is mounted mirrored
+		pitch = math.radians(5.0 + self.amp*math.sin(ph))
+		if self.side == 2:
+			pitch = -pitch
+
+		q0 = math.cos(pitch/2)
+		q1 = math.sin(pitch/2)
+
+		# Vertical acceleration in g, minus the gravity term added by Orthosis
+		acc = -math.cos(pitch) - 0.4*math.exp(-((ph % (2*math.pi)) - 1.2)**2/0.05)
+
+		# Advance the phase at the current stride frequency
+		f = self.final
+		if self.t < self.ramp:
+			f = self.cadence + (self.final - self.cadence)*self.t/self.ramp
+		self.ph = (self.ph + 2*math.pi*f*self.period) % (2*math.pi)
+
+		self.t += self.period
+		return self.period, [q0, q1, 0.0, 0.0, acc, 0.0, 0.0, 0.0, 0.0, 0.0]
+
+
+# Replay of a file written by AHRS::dump()
+class Replay(object):
+	def __init__(self, path, rate):
+		self.rows = []
+		with open(path) as f:
+			for line in f:
+				cols = [float(c) for c in line.split()]
+				if len(cols) >= NFLOATS + 1:
+					self.rows.append(cols[:NFLOATS + 1])
+
+		if not self.rows:
+			raise ValueError("No frames in " + path)
+
+		self.period = 1.0/rate
+		self.rewind()
+
+	def rewind(self):
+		self.i = 0
+
+	def next(self):
+		row = self.rows[self.i]
+		self.i = (self.i + 1) % len(self.rows)
+
+		# Use the logged time stamps when they increase, nominal period otherwise
+		nxt = self.rows[self.i]
+		dt = nxt[0] - row[0]
+		if dt <= 0 or dt > 1.0:
+			dt = self.period
+
+		return dt, row[1:]
+
+
+# Inject transmission errors into a frame
+def corrupt(data, args, stats):
+	data = bytearray(data)
+
+	if random.random() < args.corrupt:
+		data[random.randrange(len(data))] ^= 1 << random.randrange(8)
+		stats['corrupted'] += 1
+
+	if random.random() < args.garbage:
+		data[0:0] = bytearray(random.randrange(256) for i in range(random.randint(1, 8)))
+		stats['garbage'] += 1
+
+	return bytes(data)
+
+
+def main():
+	p = argparse.ArgumentParser(description = "Razor AHRS pseudo-terminal simulator")
+	p.add_argument('-n', '--imus', type = int, default = 2, help = "number of IMUs")
+	p.add_argument('-l', '--link', help = "create symlinks <LINK>1..<LINK>n to the ptys")
+	p.add_argument('-r', '--rate', type = float, default = 50.0, help = "frame rate (Hz)")
+	p.add_argument('-s', '--speed', type = float, default = 1.0, help = "time scale (2 = twice real time)")
+	p.add_argument('-c', '--cadence', type = float, default = 0.9, help = "synthetic stride frequency (Hz)")
+	p.add_argument('--cadence-to', type = float, help = "synthetic stride frequency at the end of the ramp (Hz)")
+	p.add_argument('--ramp', type = float, default = 60.0, help = "duration of the cadence ramp (s)")
+	p.add_argument('-a', '--amplitude', type = float, default = 20.0, help = "synthetic thigh amplitude (deg)")
+	p.add_argument('-f', '--replay', nargs = '+', help = "replay -Rzr<N>.txt files (one per IMU)")
+	p.add_argument('--corrupt', type = float, default = 0.0, help = "probability of a bit error per frame")
+	p.add_argument('--garbage', type = float, default = 0.0, help = "probability of inserting junk bytes before a frame")
+	p.add_argument('--drop', type = float, default = 0.0, help = "probability of dropping a frame")
+	p.add_argument('--jitter', type = float, default = 0.0, help = "send time jitter, standard deviation (ms)")
+	p.add_argument('--seed', type = int, help = "random seed")
+	args = p.parse_args()
+
+	random.seed(args.seed)
+	signal.signal(signal.SIGTERM, lambda sig, frm: sys.exit(0))
+
+	imus = []
+	for i in range(args.imus):
+		if args.replay:
+			src = Replay(args.replay[i % len(args.replay)], args.rate)
+		else:
+			src = Gait(i + 1, args.rate, args.cadence, args.amplitude, args.cadence_to, args.ramp)
+
+		imus.append(Razor(i + 1, src, args.link))
+
+	for imu in imus:
+		print("Razor %i at %s%s" % (imu.id, imu.name, " (" + imu.link + ")" if imu.link else ""))
+	sys.stdout.flush()
+
+	stats = {'sent': 0, 'dropped': 0, 'corrupted': 0, 'garbage': 0}
+
+	# Next send time for each IMU
+	due = [time.time()]*len(imus)
+	fds = dict((imu.master, imu) for imu in imus)
+
+	try:
+		while True:
+			now = time.time()
+			wait = max(0.0, min(due) - now)
+
+			r = select.select(list(fds), [], [], wait)[0]
+			for fd in r:
+				fds[fd].command()
+
+			now = time.time()
+			for i, imu in enumerate(imus):
+				if now < due[i]:
+					continue
+
+				dt, q = imu.source.next()
+				if imu.interval:
+					dt = imu.interval
+				due[i] += dt/args.speed
+
+				# Keep schedule if the host was stalled for too long
+				if due[i] < now - 1.0:
+					due[i] = now
+
+				if not imu.streaming:
+					continue
+
+				if random.random() < args.drop:
+					if imu.seq is not None:
+						imu.seq = (imu.seq + 1) & 0xFF
+					stats['dropped'] += 1
+					continue
+
+				if args.jitter > 0:
+					time.sleep(min(abs(random.gauss(0, args.jitter/1000.0)), dt/args.speed))
+
+				imu.write(corrupt(imu.frame(q), args, stats))
+				stats['sent'] += 1
+
+	except KeyboardInterrupt:
+		pass
+
+	finally:
+		for imu in imus:
+			imu.close()
+
+		print("\n%(sent)i frames sent, %(dropped)i dropped, %(corrupted)i corrupted, "
+			"%(garbage)i with junk bytes" % stats)
+
+if __name__ == '__main__':
+	main()